@@ -0,0 +1,199 @@
+#!/usr/bin/python
+# -*- coding: UTF-8 -*-
+"""
+Host check of the Teensy 3.x hardware CRC8 (CRC8_HW in src/fanatec.cpp).
+Copyright (C) 2015 darknao
+https://github.com/darknao/btClubSportWheel
+
+This file is part of btClubSportWheel.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+The K20 CRC module is emulated register by register, set up and fed
+exactly as crc8() does (16 bit CRC with the polynomial in the upper
+byte, writes with bits and bytes transposed, reads with bits transposed,
+the tail through the table), and compared with the _crc8_table CRC read
+from src/fanatec.cpp, on every prefix of captured rim frames.
+
+Usage:
+  crc8_hw_test.py [capture.txt ...]
+
+Captures are raw_capture.ino output (hex bytes, one transaction per
+line, shifted by the leading rim bit as cap.py does). Without any, the
+frames captured in cap.py are used.
+"""
+
+from __future__ import print_function
+import os
+import re
+import sys
+
+FANATEC_CPP = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                           "..", "src", "fanatec.cpp")
+
+# Frames captured with cap.py (CSW rim and UNI HUB), CRC included
+CAPTURED = """
+a5 03 00 00 00 00 00 00 48 83 87 43 5b 9a 39 a0 c9 b5 d8 19 72 30 28 fa 62 f7 93 0c cb 98 d0 12 42
+a5 03 00 80 00 00 00 00 48 83 87 43 5b 9a 39 a0 c9 b5 d8 19 72 30 28 fa 62 f7 93 0c cb 98 d0 12 58
+a5 03 10 00 00 00 00 00 48 83 87 43 5b 9a 39 a0 c9 b5 d8 19 72 30 28 fa 62 f7 93 0c cb 98 d0 12 3b
+a5 04 00 00 00 00 00 00 00 00 00 40 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 13 04
+a5 04 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 13 fc
+a5 04 00 00 00 00 00 ff 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 13 a9
+a5 04 00 00 00 00 00 01 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 13 ae
+a5 04 01 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 13 ea
+a5 04 00 00 02 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 13 94
+"""
+
+
+def load_table():
+    """ _crc8_table from the firmware """
+    src = open(FANATEC_CPP).read()
+    body = re.search(r"_crc8_table\[256\]\s*=\s*\{([^}]*)\}", src).group(1)
+    table = [int(v) for v in re.findall(r"\d+", body)]
+    assert len(table) == 256
+    return table
+
+
+def rev(value, bits):
+    """ Reverse the bit order of value """
+    return int(format(value, "0%db" % bits)[::-1], 2)
+
+
+def transpose(value, tot):
+    """ CRC_CTRL TOT/TOTR transposition of a 32 bit word """
+    if tot == 0:
+        return value
+    b = [(value >> (8 * i)) & 0xff for i in range(4)]
+    if tot in (1, 2):
+        b = [rev(x, 8) for x in b]
+    if tot in (2, 3):
+        b = b[::-1]
+    return b[0] | b[1] << 8 | b[2] << 16 | b[3] << 24
+
+
+class K20Crc(object):
+    """ CRC module, 16 bit mode (CRC_CTRL_TCRC clear) only """
+
+    def __init__(self):
+        self.ctrl = 0
+        self.gpoly = 0
+        self.crc = 0
+
+    def write_ctrl(self, value):
+        self.ctrl = value
+
+    def write_gpoly(self, value):
+        self.gpoly = value & 0xffff
+
+    def write_crc(self, value):
+        """ 32 bit write to CRC_CRC, seed or data depending on WAS """
+        tot = (self.ctrl >> 30) & 3
+        value = transpose(value, tot)
+        if self.ctrl & CRC_CTRL_WAS:
+            self.crc = value & 0xffff
+            return
+        for i in range(31, -1, -1):
+            feedback = ((self.crc >> 15) ^ (value >> i)) & 1
+            self.crc = (self.crc << 1) & 0xffff
+            if feedback:
+                self.crc ^= self.gpoly
+
+    def read_crc(self):
+        return transpose(self.crc, (self.ctrl >> 28) & 3)
+
+
+CRC_CTRL_WAS = 1 << 25
+
+
+def CRC_CTRL_TOT(n):
+    return (n & 3) << 30
+
+
+def CRC_CTRL_TOTR(n):
+    return (n & 3) << 28
+
+
+def crc8_table(table, buf):
+    crc = 0xff
+    for b in buf:
+        crc = table[b ^ crc]
+    return crc
+
+
+def crc8_hw(table, module, buf):
+    """ crc8() with CRC8_HW, crc8HwSetup() included """
+    module.write_ctrl(0)
+    module.write_gpoly(0x3100)
+    crc = 0xff
+    length = len(buf)
+    i = 0
+    if length >= 4:
+        module.write_ctrl(CRC_CTRL_WAS)
+        module.write_crc(0xff00)
+        module.write_ctrl(CRC_CTRL_TOT(2) | CRC_CTRL_TOTR(1))
+        while length - i >= 4:
+            # little endian load, as memcpy() to a uint32_t on the K20
+            module.write_crc(buf[i] | buf[i+1] << 8 | buf[i+2] << 16 | buf[i+3] << 24)
+            i += 4
+        crc = (module.read_crc() >> 8) & 0xff
+    # tail
+    for b in buf[i:]:
+        crc = table[b ^ crc]
+    return crc
+
+
+def load_capture(path):
+    """ Frames from raw_capture.ino output, realigned like cap.py """
+    frames = []
+    for line in open(path):
+        data = [int(x, 16) for x in line.split()]
+        if len(data) < 34:
+            continue
+        bits = 0
+        for b in data[:34]:
+            bits = bits << 8 | b
+        bits = (bits << 1) & ((1 << 272) - 1)
+        frame = [(bits >> (8 * (33 - i))) & 0xff for i in range(33)]
+        if frame[0] in (0xa4, 0xa5):
+            frames.append(frame)
+    return frames
+
+
+if __name__ == '__main__':
+    table = load_table()
+    module = K20Crc()
+    if len(sys.argv) > 1:
+        frames = []
+        for path in sys.argv[1:]:
+            frames += load_capture(path)
+    else:
+        frames = [[int(x, 16) for x in l.split()] for l in CAPTURED.split("\n") if l]
+
+    failed = 0
+    valid = 0
+    for frame in frames:
+        if crc8_table(table, frame[:-1]) == frame[-1]:
+            valid += 1
+        for length in range(len(frame) + 1):
+            buf = frame[:length]
+            hw = crc8_hw(table, module, buf)
+            sw = crc8_table(table, buf)
+            if hw != sw:
+                failed += 1
+                print("mismatch, length %d: hw %02x, table %02x: %s"
+                      % (length, hw, sw, " ".join("%02x" % b for b in buf)))
+
+    print("%d frames (%d with a good CRC), %d mismatches" % (len(frames), valid, failed))
+    sys.exit(1 if failed or not frames else 0)
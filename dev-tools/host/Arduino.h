@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2015 darknao
+ * https://github.com/darknao/btClubSportWheel
+ *
+ * This file is part of btClubSportWheel.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+  Minimal Arduino.h for the host tests in dev-tools/host:
+  millis() is driven by the test through host_millis.
+*/
+#ifndef _HOST_ARDUINO_H_
+#define _HOST_ARDUINO_H_
+
+#include <inttypes.h>
+
+extern unsigned long host_millis;
+
+inline unsigned long millis() { return host_millis; }
+
+#define constrain(amt, low, high) ((amt)<(low)?(low):((amt)>(high)?(high):(amt)))
+
+#endif
@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2015 darknao
+ * https://github.com/darknao/btClubSportWheel
+ *
+ * This file is part of btClubSportWheel.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+  Host test of the rotary encoder queue (src/RotaryQueue.cpp).
+  Build and run from the repository root:
+    g++ -Idev-tools/host -Isrc dev-tools/host/rotary_queue_test.cpp src/RotaryQueue.cpp -o rotary_queue_test
+    ./rotary_queue_test
+*/
+
+#include <stdio.h>
+#include "RotaryQueue.h"
+
+unsigned long host_millis = 0;
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+  if (!ok) {
+    printf("FAIL: %s\n", what);
+    failures++;
+  }
+}
+
+// Send reports until the queue is empty, return the net detents sent
+static int drain(RotaryQueue& q, int* presses) {
+  int net = 0;
+  *presses = 0;
+  for (int n = 0; n < 10000 && q.busy(); n++) {
+    int8_t v = q.value();
+    if (v) {
+      net += v;
+      (*presses)++;
+      // a detent is held, count it once
+      while (q.value() == v) q.sent();
+    } else {
+      q.sent();
+    }
+  }
+  return net;
+}
+
+// Every detent of a fast spin comes out
+static void testSpin() {
+  RotaryQueue q;
+  int presses;
+  q.hold(2);
+  for (int i = 0; i < 10; i++) q.add(3);
+  check(drain(q, &presses) == 30 && presses == 30, "spin: 30 detents");
+  check(q.overflows() == 0, "spin: no overflow");
+}
+
+// Direction changes up to ROTARY_RUNS runs are kept in order
+static void testRuns() {
+  RotaryQueue q;
+  int presses;
+  for (int i = 0; i < ROTARY_RUNS; i++) q.add(i % 2 ? -2 : 2);
+  check(drain(q, &presses) == 0 && presses == 2 * ROTARY_RUNS, "runs: every detent");
+  check(q.overflows() == 0, "runs: no overflow");
+}
+
+// More alternating runs than the queue holds: the net position is kept
+static void testAlternatingOverflow() {
+  RotaryQueue q;
+  int presses, sum = 0;
+  for (int i = 0; i < 3 * ROTARY_RUNS; i++) {
+    int8_t d = i % 2 ? -1 : 2;
+    q.add(d);
+    sum += d;
+  }
+  check(q.overflows() > 0, "overflow: counted");
+  check(drain(q, &presses) == sum, "overflow: net detents kept");
+}
+
+// A turn cancelling the last run removes it
+static void testOverflowCancel() {
+  RotaryQueue q;
+  int presses, sum = 0;
+  // the first detent is sent at once, then ROTARY_RUNS runs fill the queue
+  for (int i = 0; i <= ROTARY_RUNS; i++) {
+    int8_t d = i % 2 ? -1 : 1;
+    q.add(d);
+    sum += d;
+  }
+  check(q.overflows() == 0, "cancel: queue just full");
+  // last run is +1
+  q.add(-1);
+  sum -= 1;
+  check(q.overflows() == 1, "cancel: counted once");
+  check(drain(q, &presses) == sum && presses == ROTARY_RUNS, "cancel: run removed");
+}
+
+int main() {
+  testSpin();
+  testRuns();
+  testAlternatingOverflow();
+  testOverflowCancel();
+  printf("%s\n", failures ? "rotary queue: FAILED" : "rotary queue: ok");
+  return failures ? 1 : 0;
+}
@@ -25,6 +25,7 @@ Debouncer::Debouncer()
     : previous_millis(0)
     , interval_millis(50)
     , value(0)
+    , eager_mode(false)
 {}
 
 void Debouncer::interval(uint16_t interval_millis)
@@ -32,10 +33,18 @@ void Debouncer::interval(uint16_t interval_millis)
     this->interval_millis = interval_millis;
 }
 
+// In eager mode, leaving 0 (a press) is only held back for
+// DEBOUNCE_GUARD_MS after going back to 0, not the whole interval
+void Debouncer::eager(bool enable)
+{
+    eager_mode = enable;
+}
+
 uint8_t Debouncer::get(uint8_t current_value)
 {
     if(current_value != value) {
-        if ( millis() - previous_millis >= interval_millis ) {
+        uint16_t lockout = (eager_mode && value == 0) ? DEBOUNCE_GUARD_MS : interval_millis;
+        if ( millis() - previous_millis >= lockout ) {
             previous_millis = millis();
             setValue(current_value);
         }
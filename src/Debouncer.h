@@ -23,18 +23,23 @@
 
 #include <inttypes.h>
 
+// Eager mode: lockout after going back to 0 (release chatter), in ms
+#define DEBOUNCE_GUARD_MS 8
+
 class Debouncer
 {
   public:
     Debouncer();
 
     void interval(uint16_t interval_millis);
+    void eager(bool enable);
     uint8_t get(uint8_t value);
 
   protected:
     unsigned long previous_millis;
     uint16_t interval_millis;
     uint8_t value;
+    bool eager_mode;
 
   private:
     inline void setValue(uint8_t value) {this->value = value;}
@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2015 darknao
+ * https://github.com/darknao/btClubSportWheel
+ *
+ * This file is part of btClubSportWheel.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "RotaryQueue.h"
+#include "Arduino.h"
+
+RotaryQueue::RotaryQueue()
+    : head(0)
+    , count(0)
+    , rel(0)
+    , current(0)
+    , releasing(false)
+    , held(0)
+    , hold_reports(1)
+    , accel_millis(0)
+    , accel_factor(1)
+    , previous_millis(0)
+    , overflow(0)
+{}
+
+// HID reports a detent stays pressed (and then released)
+void RotaryQueue::hold(uint8_t reports)
+{
+    hold_reports = reports ? reports : 1;
+}
+
+// Detents within window_millis of the last ones count factor times
+// (factor 1 or window 0: off)
+void RotaryQueue::acceleration(uint16_t window_millis, uint8_t factor)
+{
+    accel_millis = window_millis;
+    accel_factor = factor ? factor : 1;
+}
+
+void RotaryQueue::add(int8_t delta)
+{
+    if (!delta) return;
+
+    rel = constrain(rel + delta, -127, 127);
+    int16_t detents = delta;
+    if (millis() - previous_millis < accel_millis) detents *= accel_factor;
+    previous_millis = millis();
+
+    // same direction as the last run: extend it, else start a new one
+    if (count) {
+        int8_t& last = runs[(head + count - 1) % ROTARY_RUNS];
+        if ((last > 0) == (delta > 0)) {
+            last = constrain(last + detents, -ROTARY_RUN_MAX, ROTARY_RUN_MAX);
+            next();
+            return;
+        }
+    }
+    if (count < ROTARY_RUNS) {
+        runs[(head + count++) % ROTARY_RUNS] = constrain(detents, -ROTARY_RUN_MAX, ROTARY_RUN_MAX);
+    } else {
+        // queue full: net the turn back into the last run
+        int8_t& last = runs[(head + count - 1) % ROTARY_RUNS];
+        last = constrain(last + detents, -ROTARY_RUN_MAX, ROTARY_RUN_MAX);
+        if (!last) count--;
+        if (overflow < 0xFFFF) overflow++;
+    }
+    next();
+}
+
+void RotaryQueue::clear()
+{
+    head = 0;
+    count = 0;
+    rel = 0;
+    current = 0;
+    releasing = false;
+    held = 0;
+}
+
+// Start the next detent, if the last one is over
+void RotaryQueue::next()
+{
+    if (current || releasing || !count) return;
+    int8_t& run = runs[head];
+    current = run > 0 ? 1 : -1;
+    run -= current;
+    if (!run) {
+        head = (head + 1) % ROTARY_RUNS;
+        count--;
+    }
+    held = 0;
+}
+
+// One HID report went out with value() and relative()
+void RotaryQueue::sent()
+{
+    rel = 0;
+    if (!current && !releasing) return;
+    if (++held < hold_reports) return;
+
+    held = 0;
+    if (current) {
+        current = 0;
+        releasing = true;
+    } else {
+        releasing = false;
+        next();
+    }
+}
+
+// Detent being sent: -1 (left), 1 (right) or 0
+int8_t RotaryQueue::value()
+{
+    return current;
+}
+
+// A detent is being sent or waiting: reports should keep going out
+bool RotaryQueue::busy()
+{
+    return current || releasing || count;
+}
+
+// Detents since the last report
+int8_t RotaryQueue::relative()
+{
+    return rel;
+}
+
+// Turns netted into the last run because the queue was full
+uint16_t RotaryQueue::overflows()
+{
+    return overflow;
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2015 darknao
+ * https://github.com/darknao/btClubSportWheel
+ *
+ * This file is part of btClubSportWheel.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _ROTARYQUEUE_H_
+#define _ROTARYQUEUE_H_
+
+#include <inttypes.h>
+
+// Runs of detents in the same direction waiting to be sent,
+// and most detents in a run
+#define ROTARY_RUNS 8
+#define ROTARY_RUN_MAX 127
+
+/*
+  Rotary encoder pulse queue. The signed deltas of every frame are
+  queued, then sent one detent at a time: a press held for a number of
+  HID reports, then a release held as long. No detent is dropped, however
+  fast the encoder turns: once ROTARY_RUNS runs are queued, a turn the
+  other way is merged into the last run (net detents) and counted in
+  overflows().
+  Optionally, detents coming within a time window of the previous ones
+  are multiplied (acceleration).
+  The raw detents are also summed as a relative axis, reset every report.
+*/
+class RotaryQueue
+{
+  public:
+    RotaryQueue();
+
+    void hold(uint8_t reports);
+    void acceleration(uint16_t window_millis, uint8_t factor);
+    void add(int8_t delta);
+    void clear();
+    void sent();
+    int8_t value();
+    bool busy();
+    int8_t relative();
+    uint16_t overflows();
+
+  protected:
+    int8_t runs[ROTARY_RUNS];
+    uint8_t head;
+    uint8_t count;
+    int16_t rel;
+    int8_t current;
+    bool releasing;
+    uint8_t held;
+    uint8_t hold_reports;
+    uint16_t accel_millis;
+    uint8_t accel_factor;
+    unsigned long previous_millis;
+    uint16_t overflow;
+
+  private:
+    void next();
+};
+
+#endif
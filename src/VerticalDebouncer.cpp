@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2015 darknao
+ * https://github.com/darknao/btClubSportWheel
+ *
+ * This file is part of btClubSportWheel.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "VerticalDebouncer.h"
+#include "Arduino.h"
+
+VerticalDebouncer::VerticalDebouncer()
+    : last_tick(0)
+{
+    for (uint8_t w=0; w<VD_WORDS; w++) {
+        state[w] = 0;
+        eager_mask[w] = 0;
+        for (uint8_t p=0; p<4; p++) {
+            count[p][w] = 0;
+            reload[p][w] = 0;
+        }
+    }
+    // 50ms by default, like Debouncer
+    for (uint8_t b=0; b<VD_WORDS*32; b++) interval(b, 50);
+}
+
+void VerticalDebouncer::interval(uint8_t button, uint16_t interval_millis)
+{
+    uint8_t ticks = (interval_millis + VD_TICK_MS - 1) / VD_TICK_MS;
+    if (ticks > 15) ticks = 15;
+    uint32_t bit = 1UL << (button & 31);
+    for (uint8_t p=0; p<4; p++) {
+        if (ticks & (1 << p)) reload[p][button >> 5] |= bit;
+        else reload[p][button >> 5] &= ~bit;
+    }
+}
+
+void VerticalDebouncer::eager(uint8_t button, bool enable)
+{
+    uint32_t bit = 1UL << (button & 31);
+    if (enable) eager_mask[button >> 5] |= bit;
+    else eager_mask[button >> 5] &= ~bit;
+}
+
+// Debounce a full raw button vector (VD_WORDS words)
+void VerticalDebouncer::update(const uint32_t* raw)
+{
+    uint32_t now = millis();
+    uint32_t ticks = (now - last_tick) / VD_TICK_MS;
+    if (ticks > 15) ticks = 15;
+    last_tick += ticks * VD_TICK_MS;
+    if (ticks == 15) last_tick = now;
+
+    for (uint8_t w=0; w<VD_WORDS; w++) {
+        uint32_t c0 = count[0][w], c1 = count[1][w];
+        uint32_t c2 = count[2][w], c3 = count[3][w];
+
+        // count down the running counters, once per elapsed tick
+        for (uint32_t t=0; t<ticks; t++) {
+            uint32_t borrow = c0 | c1 | c2 | c3;
+            if (!borrow) break;
+            c0 ^= borrow; borrow &= c0;
+            c1 ^= borrow; borrow &= c1;
+            c2 ^= borrow; borrow &= c2;
+            c3 ^= borrow;
+        }
+
+        // take the changes of the buttons out of lockout, and lock them
+        uint32_t accept = (raw[w] ^ state[w]) & ~(c0 | c1 | c2 | c3);
+        state[w] ^= accept;
+        // eager releases only get the short guard
+        uint32_t guard = accept & ~state[w] & eager_mask[w];
+        uint32_t full = accept & ~guard;
+        c0 = (c0 & ~accept) | (reload[0][w] & full) | ((VD_GUARD_TICKS & 1) ? guard : 0);
+        c1 = (c1 & ~accept) | (reload[1][w] & full) | ((VD_GUARD_TICKS & 2) ? guard : 0);
+        c2 = (c2 & ~accept) | (reload[2][w] & full) | ((VD_GUARD_TICKS & 4) ? guard : 0);
+        c3 = (c3 & ~accept) | (reload[3][w] & full) | ((VD_GUARD_TICKS & 8) ? guard : 0);
+
+        count[0][w] = c0; count[1][w] = c1;
+        count[2][w] = c2; count[3][w] = c3;
+    }
+}
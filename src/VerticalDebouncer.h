@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2015 darknao
+ * https://github.com/darknao/btClubSportWheel
+ *
+ * This file is part of btClubSportWheel.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _VERTICALDEBOUNCER_H_
+#define _VERTICALDEBOUNCER_H_
+
+#include <inttypes.h>
+
+// Debounce timer resolution, in ms (4 bit counters: up to 15 ticks)
+#define VD_TICK_MS 4
+#define VD_WORDS 3
+// Eager mode: lockout after a release edge, in ticks (release chatter)
+#define VD_GUARD_TICKS 2
+
+/*
+  Lockout debouncer for up to 96 buttons, bit-sliced: bit n of every
+  word belongs to button n. Each button has a 4 bit down counter spread
+  over 4 bit planes (vertical counter), so a whole button vector is
+  debounced with a few AND/XOR per word.
+  Like Debouncer, a change is taken right away, then further changes
+  of that button are held back until its interval has elapsed.
+  In eager mode, only a press locks the button for the whole interval,
+  a release just for VD_GUARD_TICKS, so a quick re-press goes through.
+*/
+class VerticalDebouncer
+{
+  public:
+    VerticalDebouncer();
+
+    void interval(uint8_t button, uint16_t interval_millis);
+    void eager(uint8_t button, bool enable);
+    void update(const uint32_t* raw);
+
+    bool get(uint8_t button) const {
+      return (state[button >> 5] >> (button & 31)) & 1;
+    }
+    const uint32_t* value() const { return state; }
+
+  protected:
+    uint32_t state[VD_WORDS];
+    uint32_t count[4][VD_WORDS];
+    uint32_t reload[4][VD_WORDS];
+    uint32_t eager_mask[VD_WORDS];
+    uint32_t last_tick;
+};
+
+#endif
@@ -0,0 +1,268 @@
+/*
+ * Copyright (C) 2015 darknao
+ * https://github.com/darknao/btClubSportWheel
+ *
+ * This file is part of btClubSportWheel.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "buttonmap.h"
+
+/*
+  Default mapping tables, one per rim ID (or group of IDs).
+  Buttons not listed (encoder, clutch modes, GT3 switches) are decoded
+  in csw.cpp.
+*/
+#define MAP_BIT(offset, mask, button) {offset, mask, mask, button}
+
+static const button_map_t map_csw_default[] = {
+  MAP_BIT(MAP_BTN0, 0x80, 1),  // first top right
+  MAP_BIT(MAP_BTN0, 0x40, 2),  // middle right
+  MAP_BIT(MAP_BTN0, 0x20, 3),  // second top right
+  MAP_BIT(MAP_BTN0, 0x10, 4),  // bottom right
+  MAP_BIT(MAP_BTN1, 0x80, 5),  // third center
+  MAP_BIT(MAP_BTN1, 0x40, 6),  // first center
+  MAP_BIT(MAP_BTN1, 0x20, 7),  // middle left
+  MAP_BIT(MAP_BTN1, 0x10, 8),  // first top left
+  MAP_BIT(MAP_BTN1, 0x04, 9),  // bottom left
+  MAP_BIT(MAP_BTN1, 0x02, 10), // second top left
+  MAP_BIT(MAP_BTN2, 0x08, 11), // second center
+  MAP_BIT(MAP_BTN2, 0x04, 12), // stick button
+  MAP_BIT(MAP_BTN2, 0x02, 13), // hat button
+  MAP_BIT(MAP_BTN2, 0x20, 14), // display button
+  MAP_BIT(MAP_BTN1, 0x08, 15), // left paddle
+  MAP_BIT(MAP_BTN1, 0x01, 16), // right paddle
+};
+
+static const button_map_t map_gt3_default[] = {
+  MAP_BIT(MAP_BTN0, 0x80, 1),
+  MAP_BIT(MAP_BTN0, 0x40, 2),
+  MAP_BIT(MAP_BTN0, 0x20, 3),
+  MAP_BIT(MAP_BTN0, 0x10, 4),
+  MAP_BIT(MAP_BTN1, 0x80, 5),
+  MAP_BIT(MAP_BTN1, 0x40, 6),
+  MAP_BIT(MAP_BTN1, 0x20, 7),
+  MAP_BIT(MAP_BTN1, 0x04, 9),
+  MAP_BIT(MAP_BTN2, 0x08, 11),
+  MAP_BIT(MAP_BTN2, 0x04, 12),
+  MAP_BIT(MAP_BTN2, 0x02, 14), // xbox
+  MAP_BIT(MAP_BTN1, 0x08, 15), // left paddle
+  MAP_BIT(MAP_BTN1, 0x01, 16), // right paddle
+};
+
+static const button_map_t map_mcl_default[] = {
+  MAP_BIT(MAP_BTN0, 0x80, 1),  // Y
+  MAP_BIT(MAP_BTN0, 0x40, 2),  // B
+  MAP_BIT(MAP_BTN0, 0x20, 3),  // X
+  MAP_BIT(MAP_BTN0, 0x10, 4),  // A
+  MAP_BIT(MAP_BTN1, 0x80, 5),  // P
+  MAP_BIT(MAP_BTN1, 0x40, 6),  // N
+  MAP_BIT(MAP_BTN1, 0x20, 7),  // LSB
+  MAP_BIT(MAP_BTN1, 0x04, 9),  // RSB
+  MAP_BIT(MAP_BTN2, 0x04, 12), // hat button
+  MAP_BIT(MAP_BTN2, 0x02, 14), // xbox
+  MAP_BIT(MAP_BTN1, 0x08, 15), // left paddle
+  MAP_BIT(MAP_BTN1, 0x01, 16), // right paddle
+};
+
+#define MAP_HUB_BUTTONS \
+  MAP_BIT(MAP_HUB0, 0x08, 19), /* BUT_5 array (optional 3 buttons) */ \
+  MAP_BIT(MAP_HUB0, 0x10, 20), \
+  MAP_BIT(MAP_HUB0, 0x20, 21), \
+  MAP_BIT(MAP_PS0, 0x01, 22), /* Playstation buttons */ \
+  MAP_BIT(MAP_PS0, 0x02, 23), \
+  MAP_BIT(MAP_PS0, 0x04, 24), \
+  MAP_BIT(MAP_PS0, 0x08, 25), \
+  MAP_BIT(MAP_PS0, 0x10, 26), \
+  MAP_BIT(MAP_PS0, 0x20, 27), \
+  MAP_BIT(MAP_PS0, 0x40, 28), \
+  MAP_BIT(MAP_PS0, 0x80, 29), \
+  MAP_BIT(MAP_PS1, 0x01, 30), \
+  MAP_BIT(MAP_PS1, 0x02, 31), \
+  MAP_BIT(MAP_PS1, 0x04, 32), \
+  MAP_BIT(MAP_PS1, 0x08, 33), \
+  MAP_BIT(MAP_PS1, 0x10, 34), \
+  MAP_BIT(MAP_PS1, 0x20, 35), \
+  MAP_BIT(MAP_PS1, 0x40, 36), \
+  MAP_BIT(MAP_PS1, 0x80, 37)
+
+static const button_map_t map_unihub_default[] = {
+  MAP_HUB_BUTTONS
+};
+
+static const button_map_t map_xboxhub_default[] = {
+  MAP_HUB_BUTTONS,
+  MAP_BIT(MAP_HUB1, 0x08, 38), // Xbox Hub has 1 extra button
+};
+
+#define MAP_LEN(map) (sizeof(map) / sizeof(button_map_t))
+
+static button_map_t map_csw[MAP_LEN(map_csw_default) + MAP_SPARE];
+static button_map_t map_gt3[MAP_LEN(map_gt3_default) + MAP_SPARE];
+static button_map_t map_mcl[MAP_LEN(map_mcl_default) + MAP_SPARE];
+static button_map_t map_unihub[MAP_LEN(map_unihub_default) + MAP_SPARE];
+static button_map_t map_xboxhub[MAP_LEN(map_xboxhub_default) + MAP_SPARE];
+static_assert(MAP_LEN(map_xboxhub) <= MAP_REST, "MAP_REST below the largest table");
+
+static const button_map_t* const map_defaults[MAP_TABLES] = {
+  map_csw_default, map_gt3_default, map_mcl_default,
+  map_unihub_default, map_xboxhub_default
+};
+
+button_table_t map_tables[MAP_TABLES] = {
+  {map_csw, MAP_LEN(map_csw_default), MAP_LEN(map_csw)},
+  {map_gt3, MAP_LEN(map_gt3_default), MAP_LEN(map_gt3)},
+  {map_mcl, MAP_LEN(map_mcl_default), MAP_LEN(map_mcl)},
+  {map_unihub, MAP_LEN(map_unihub_default), MAP_LEN(map_unihub)},
+  {map_xboxhub, MAP_LEN(map_xboxhub_default), MAP_LEN(map_xboxhub)},
+};
+
+/*
+  Split a table into bulk groups and the entries left to the interpreter:
+  chains, multi bit masks, buttons pressed on a cleared bit and offsets
+  past the last whole frame word, or anything past MAP_GROUPS groups.
+*/
+static void mapCompile(button_table_t* t) {
+  t->groups = 0;
+  t->src_words = 0;
+  t->rests = 0;
+  for (uint8_t i=0; i<t->count; i++) {
+    const button_map_t& e = t->map[i];
+    bool chained = (e.button & MAP_AND) || (i && (t->map[i-1].button & MAP_AND));
+    bool single = e.mask && !(e.mask & (e.mask - 1)) && e.value == e.mask;
+    if (!chained && single && e.offset < MAP_WORDS * 4) {
+      uint8_t bit = (e.offset & 3) * 8;
+      while (!((e.mask >> (bit & 7)) & 1)) bit++;
+      uint8_t src = e.offset >> 2;
+      uint8_t dst = e.button >> 5;
+      uint8_t rot = ((e.button & 31) - bit) & 31;
+      uint8_t g = 0;
+      while (g < t->groups && (t->group[g].src != src
+          || t->group[g].dst != dst || t->group[g].rot != rot)) g++;
+      if (g < MAP_GROUPS) {
+        if (g == t->groups) {
+          t->group[g].mask = 0;
+          t->group[g].src = src;
+          t->group[g].dst = dst;
+          t->group[g].rot = rot;
+          t->groups++;
+        }
+        t->group[g].mask |= 1UL << bit;
+        t->src_words |= 1 << src;
+        continue;
+      }
+    }
+    t->rest[t->rests++] = i;
+  }
+}
+
+// Buttons a table writes: the last entry of every chain.
+// The ones it stops writing are kept in released.
+static void mapOwned(button_table_t* t) {
+  uint32_t old[VD_WORDS];
+  memcpy(old, t->owned, sizeof(old));
+  memset(t->owned, 0, sizeof(t->owned));
+  for (uint8_t i=0; i<t->count; i++) {
+    uint8_t button = t->map[i].button;
+    if (!(button & MAP_AND)) t->owned[button >> 5] |= 1UL << (button & 31);
+  }
+  t->owned[0] &= ~1UL; // button 0: unmapped
+  for (uint8_t w=0; w<VD_WORDS; w++)
+    t->released[w] = (t->released[w] | old[w]) & ~t->owned[w];
+  mapCompile(t);
+}
+
+// Restore the default tables
+void mapReset() {
+  static const uint8_t counts[MAP_TABLES] = {
+    MAP_LEN(map_csw_default), MAP_LEN(map_gt3_default), MAP_LEN(map_mcl_default),
+    MAP_LEN(map_unihub_default), MAP_LEN(map_xboxhub_default)
+  };
+  for (uint8_t i=0; i<MAP_TABLES; i++) {
+    button_table_t* t = &map_tables[i];
+    t->count = counts[i];
+    memcpy(t->map, map_defaults[i], t->count * sizeof(button_map_t));
+    mapOwned(t);
+  }
+}
+
+// Replace entry index, or append it if index is the entry count
+bool mapSet(button_table_t* t, uint8_t index, const button_map_t& entry) {
+  if (!t || index > t->count || index >= t->size) return false;
+  if (entry.offset >= sizeof(csw_in_t) || (entry.button & ~MAP_AND) >= VD_WORDS * 32) return false;
+  t->map[index] = entry;
+  if (index == t->count) t->count++;
+  mapOwned(t);
+  return true;
+}
+
+// Move every entry of HID button from to button to (0: unmapped)
+// Returns the number of entries changed
+uint8_t mapRemap(button_table_t* t, uint8_t from, uint8_t to) {
+  uint8_t n = 0;
+  if (!t || to >= VD_WORDS * 32 || to & MAP_AND) return 0;
+  for (uint8_t i=0; i<t->count; i++) {
+    uint8_t button = t->map[i].button;
+    if ((button & ~MAP_AND) != from) continue;
+    t->map[i].button = (button & MAP_AND) | to;
+    n++;
+  }
+  if (n) mapOwned(t);
+  return n;
+}
+
+// Clear in the button bitmap the buttons the table stopped writing since
+// the last call (mapDecode() would leave them as they were)
+void mapRelease(button_table_t* t, uint32_t* buttons) {
+  if (!t) return;
+  for (uint8_t w=0; w<VD_WORDS; w++) {
+    buttons[w] &= ~t->released[w];
+    t->released[w] = 0;
+  }
+}
+
+/*
+  Decode a rim frame into the button bitmap: the frame words are loaded
+  once, each group moves all its bits with a mask and a rotation, the
+  other entries are evaluated one by one. Then the buttons owned by the
+  table are merged into buttons[] one word at a time.
+*/
+void mapDecode(const button_table_t* t, const uint8_t* raw, uint32_t* buttons) {
+  uint32_t src[MAP_WORDS];
+  uint32_t bits[VD_WORDS] = {0};
+  uint8_t hit = 1;
+
+  for (uint8_t w=0; w<MAP_WORDS; w++) {
+    if ((t->src_words >> w) & 1) memcpy(&src[w], raw + 4 * w, 4);
+  }
+  const map_group_t* g = t->group;
+  const map_group_t* gend = g + t->groups;
+  for (; g < gend; g++) {
+    uint32_t v = src[g->src] & g->mask;
+    bits[g->dst] |= (v << g->rot) | (v >> (-g->rot & 31));
+  }
+
+  const uint8_t* r = t->rest;
+  const uint8_t* rend = r + t->rests;
+  for (; r < rend; r++) {
+    const button_map_t* e = &t->map[*r];
+    hit &= (raw[e->offset] & e->mask) == e->value;
+    if (e->button & MAP_AND) continue;
+    bits[e->button >> 5] |= (uint32_t)hit << (e->button & 31);
+    hit = 1;
+  }
+  for (uint8_t w=0; w<VD_WORDS; w++)
+    buttons[w] = (buttons[w] & ~t->owned[w]) | (bits[w] & t->owned[w]);
+}
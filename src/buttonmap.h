@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2015 darknao
+ * https://github.com/darknao/btClubSportWheel
+ *
+ * This file is part of btClubSportWheel.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _BUTTONMAP_H_
+#define _BUTTONMAP_H_
+
+#include "fanatec.h"
+#include "VerticalDebouncer.h"
+
+/*
+  Rim frame to HID button mapping.
+  Each entry presses its button when (raw[offset] & mask) == value.
+  With MAP_AND set in button, the entry is ANDed with the next one,
+  the last entry of the chain holds the button.
+  Tables live in RAM and can be edited at runtime (mapSet, mapRemap).
+*/
+struct button_map_t {
+  uint8_t offset;
+  uint8_t mask;
+  uint8_t value;
+  uint8_t button;
+};
+
+#define MAP_AND 0x80
+
+// Frame byte offsets (CSW and MCL frames share the layout)
+#define MAP_BTN0   2  // buttons[0]
+#define MAP_BTN1   3  // buttons[1]
+#define MAP_BTN2   4  // buttons[2]
+#define MAP_HUB0   8  // btnHub[0]
+#define MAP_HUB1   9  // btnHub[1]
+#define MAP_PS0    10 // btnPS[0]
+#define MAP_PS1    11 // btnPS[1]
+
+// Free entries in each table, for buttons added at runtime
+#define MAP_SPARE 4
+
+/*
+  Bulk extraction, see mapCompile(). Single bit entries that move bits
+  between the same frame word and button word by the same amount share
+  a group: one AND and one rotation for all of them.
+*/
+struct map_group_t {
+  uint32_t mask; // frame word bits
+  uint8_t src;   // frame word (raw bytes 4*src to 4*src+3)
+  uint8_t dst;   // button word
+  uint8_t rot;   // left rotation, frame bit to button bit
+};
+
+#define MAP_GROUPS 16
+#define MAP_WORDS  8  // frame words groups can read (bytes 0-31)
+#define MAP_REST   24 // largest table
+
+struct button_table_t {
+  button_map_t* map;
+  uint8_t count;
+  uint8_t size;
+  uint32_t owned[VD_WORDS]; // buttons written by this table
+  uint32_t released[VD_WORDS]; // owned before an edit, see mapRelease()
+  map_group_t group[MAP_GROUPS];
+  uint8_t groups;
+  uint8_t src_words;      // frame words read by the groups (bitmap)
+  uint8_t rest[MAP_REST]; // entries left to the interpreter
+  uint8_t rests;
+};
+
+// Tables
+#define MAP_CSW     0 // CSW rims
+#define MAP_GT3     1 // CSW McLaren GT3
+#define MAP_MCL     2 // CSL McLaren GT3
+#define MAP_UNIHUB  3 // Uni Hub extra buttons
+#define MAP_XBOXHUB 4 // Xbox Hub extra buttons
+#define MAP_TABLES  5
+
+extern button_table_t map_tables[MAP_TABLES];
+
+inline button_table_t* mapTable(uint8_t table) {
+  return table < MAP_TABLES ? &map_tables[table] : NULL;
+}
+
+void mapReset();
+bool mapSet(button_table_t* t, uint8_t index, const button_map_t& entry);
+uint8_t mapRemap(button_table_t* t, uint8_t from, uint8_t to);
+void mapRelease(button_table_t* t, uint32_t* buttons);
+void mapDecode(const button_table_t* t, const uint8_t* raw, uint32_t* buttons);
+
+#endif
@@ -0,0 +1,202 @@
+/*
+ * Copyright (C) 2015 darknao
+ * https://github.com/darknao/btClubSportWheel
+ *
+ * This file is part of btClubSportWheel.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "calibration.h"
+
+/*
+  SPI timing calibration.
+  On rim insertion, the stored timing for the rim ID is loaded from
+  EEPROM. If there is none, candidates are swept from the fastest clock
+  down (then smallest CS setup time, then SPI mode 0 before 1) and the
+  first one giving CAL_FRAMES good frames in a row is kept and stored.
+  A candidate is dropped at its first bad frame. The rim detection is
+  left alone: if it drops the rim meanwhile, so does the calibration.
+  A candidate bad enough to lose the rim is skipped when the same rim
+  type and ID is detected again, the sweep resumes with the next one.
+  One candidate is tried per call, so loop() keeps running meanwhile.
+*/
+
+// CS setup time candidates, in µs
+const uint8_t cal_delays[3] = {0, 2, 5};
+#define CAL_CANDIDATES (RIM_CLOCKS * sizeof(cal_delays) * 2)
+
+enum cal_step {
+  CAL_ID,
+  CAL_SWEEP,
+  CAL_DONE
+};
+cal_step cal_state = CAL_DONE;
+uint32_t cal_session = 0xFFFFFFFF;
+uint8_t cal_id;
+uint8_t cal_candidate;
+uint8_t cal_retries;
+// Sweep to resume after the rim was lost (cal_resume 0: none)
+wheel_type cal_resume_type;
+uint8_t cal_resume_id;
+uint8_t cal_resume = 0;
+
+csw_out_t cal_out;
+csw_in_t cal_in;
+csl_out_t cal_csl_out;
+csl_in_t cal_csl_in;
+
+static uint8_t* calEntry(wheel_type type, uint8_t id) {
+  return (uint8_t*)(CAL_EEPROM_ADDR + 1 + 2 * ((type - CSW_WHEEL) * CAL_MAX_ID + id));
+}
+
+// Stored timing for the rim type and ID, if any
+static bool calLoad(wheel_type type, uint8_t id) {
+  if (id >= CAL_MAX_ID) return false;
+  if (eeprom_read_byte((uint8_t*)CAL_EEPROM_ADDR) != CAL_MAGIC) return false;
+  uint8_t timing = eeprom_read_byte(calEntry(type, id));
+  uint8_t cs_wait = eeprom_read_byte(calEntry(type, id) + 1);
+  // bits 0-3: clock, bit 4: mode, 0xFF: empty
+  if (timing == 0xFF || (timing & 0x0F) >= RIM_CLOCKS) return false;
+  rimSetTiming(type, timing & 0x0F, (timing >> 4) & 1, cs_wait);
+  return true;
+}
+
+static void calSave(wheel_type type, uint8_t id, uint8_t clock, uint8_t mode, uint8_t cs_wait) {
+  if (id >= CAL_MAX_ID) return;
+  if (eeprom_read_byte((uint8_t*)CAL_EEPROM_ADDR) != CAL_MAGIC) calibrationClear();
+  eeprom_write_byte(calEntry(type, id), clock | (mode << 4));
+  eeprom_write_byte(calEntry(type, id) + 1, cs_wait);
+}
+
+// Forget every stored timing
+void calibrationClear() {
+  eeprom_write_byte((uint8_t*)CAL_EEPROM_ADDR, CAL_MAGIC);
+  for (uint8_t i=0; i<CAL_TYPES * CAL_MAX_ID; i++) {
+    eeprom_write_byte(calEntry(CSW_WHEEL, i), 0xFF);
+    eeprom_write_byte(calEntry(CSW_WHEEL, i) + 1, 0xFF);
+  }
+}
+
+/*
+  Exchange up to count frames with the current timing, stop at the first
+  bad one and return false. A wrong CSL header or a bad CSW/MCL header
+  with a good CRC also drops the rim (see transferCswData).
+*/
+static bool calFrames(wheel_type type, uint8_t count) {
+  rim_stats_t stats;
+  stats.good = rim_stats.good;
+  stats.bad = rim_stats.bad;
+  stats.realigned = rim_stats.realigned;
+  bool good = true;
+
+  for (uint8_t n=0; n<count && good; n++) {
+    switch (type) {
+      case CSW_WHEEL:
+        // a bit slip is an error too, it comes from the timing as well
+        good = transferCswData(&cal_out, &cal_in, sizeof(cal_out.raw))
+          && rim_stats.realigned == stats.realigned;
+        break;
+      case MCL_WHEEL:
+        good = transferMclData((mcl_out_t*)&cal_out, (mcl_in_t*)&cal_in, sizeof(cal_out.raw));
+        break;
+      default:
+        transferCslData(&cal_csl_out, &cal_csl_in, sizeof(cal_csl_out.raw), 0x00);
+        good = cal_csl_in.raw[0] == 0xE0;
+        break;
+    }
+    good = good && rim_inserted == type;
+  }
+
+  // calibration frames don't count in the session stats
+  rim_stats.good = stats.good;
+  rim_stats.bad = stats.bad;
+  rim_stats.realigned = stats.realigned;
+  return good;
+}
+
+// Calibrate the rim just detected, return true once done
+bool rimCalibrate(wheel_type type) {
+  if (cal_session != rim_session) {
+    // new rim
+    cal_session = rim_session;
+    cal_state = CAL_ID;
+    cal_retries = 0;
+    memset(cal_out.raw, 0, sizeof(cal_out.raw));
+    cal_out.header = 0xa5;
+    memset(cal_csl_out.raw, 0, sizeof(cal_csl_out.raw));
+  }
+
+  switch (cal_state) {
+    case CAL_ID:
+      if (type == CSL_WHEEL) {
+        cal_id = CSLP1XBOX;
+      } else if (calFrames(type, 1)) {
+        cal_id = cal_in.id;
+      } else {
+        // no good frame at the detection timing, give up after a while
+        // (or now if the rim is gone)
+        if (++cal_retries >= CAL_FRAMES || rim_inserted != type) cal_state = CAL_DONE;
+        break;
+      }
+      if (calLoad(type, cal_id)) {
+        #ifdef HAS_DEBUG
+        Serial.println(String("calibration: loaded timing for rim ") + cal_id);
+        #endif
+        cal_state = CAL_DONE;
+      } else {
+        cal_candidate = 0;
+        if (cal_resume && cal_resume_type == type && cal_resume_id == cal_id) {
+          cal_candidate = cal_resume;
+        }
+        cal_resume = 0;
+        cal_state = CAL_SWEEP;
+        if (cal_candidate >= CAL_CANDIDATES) {
+          // every candidate lost the rim, keep the detection timing
+          cal_state = CAL_DONE;
+        }
+      }
+      break;
+    case CAL_SWEEP: {
+      uint8_t clock = cal_candidate / (sizeof(cal_delays) * 2);
+      uint8_t cs_wait = cal_delays[(cal_candidate / 2) % sizeof(cal_delays)];
+      uint8_t mode = cal_candidate % 2;
+      rimSetTiming(type, clock, mode, cs_wait);
+      bool good = calFrames(type, CAL_FRAMES);
+      #ifdef HAS_DEBUG
+      Serial.println(String("calibration: ") + rim_clocks[clock] + "Hz mode " + mode
+        + " cs " + cs_wait + "us: " + (good ? "ok" : "failed"));
+      #endif
+      if (rim_inserted != type) {
+        // rim lost, detection starts over (at its own timing), then
+        // the sweep goes on with the next candidate
+        cal_resume_type = type;
+        cal_resume_id = cal_id;
+        cal_resume = cal_candidate + 1;
+        cal_state = CAL_DONE;
+      } else if (good) {
+        calSave(type, cal_id, clock, mode, cs_wait);
+        cal_state = CAL_DONE;
+      } else if (++cal_candidate >= CAL_CANDIDATES) {
+        // nothing works, keep the detection timing
+        rimDefaultTiming();
+        cal_state = CAL_DONE;
+      }
+      break;
+    }
+    case CAL_DONE:
+      break;
+  }
+  return cal_state == CAL_DONE && rim_inserted == type;
+}
@@ -0,0 +1,37 @@
+/*
+ * Copyright (C) 2015 darknao
+ * https://github.com/darknao/btClubSportWheel
+ *
+ * This file is part of btClubSportWheel.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _CALIBRATION_H_
+#define _CALIBRATION_H_
+
+#include "fanatec.h"
+
+// EEPROM layout: magic byte, then 2 bytes per rim type and ID
+#define CAL_EEPROM_ADDR 0
+#define CAL_MAGIC 0xCB
+#define CAL_MAX_ID 16
+#define CAL_TYPES 3 // CSW, CSL, MCL
+
+// Frames exchanged per candidate, all must be good
+#define CAL_FRAMES 32
+
+bool rimCalibrate(wheel_type type);
+void calibrationClear();
+
+#endif
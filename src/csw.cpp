@@ -25,16 +25,42 @@
 #include "fanatec.h"
 #include "iWRAP.h"
 #include "Debouncer.h"
+#include "VerticalDebouncer.h"
+#include "RotaryQueue.h"
+#ifdef HAS_DEBUG
+#include "cycles.h"
+#endif
+#include "calibration.h"
+#include "usbsync.h"
+#include "buttonmap.h"
 
 /* WT12 (Bluetooth specifics) */
 #define WT12 Serial1
 #define CTS 18
 
-#define MAX_SPEED   5000
+/*
+  USB reports go out as soon as an input changed, but no closer than
+  USB_MIN_INTERVAL (changes in between are coalesced). Unchanged reports
+  are repeated by the USB stack at the host's idle rate (HID SET_IDLE).
+  In µs, can be overridden with -DUSB_MIN_INTERVAL=n in the Makefile OPTIONS.
+*/
+#ifndef USB_MIN_INTERVAL
+#define USB_MIN_INTERVAL  1000
+#endif
 
 uint8_t iwrap_mode = IWRAP_MODE_MUX;
 
-uint8_t hid_data[35];
+/*
+  BT input report, after the 3 bytes iWRAP header: buttons 1-48, X, Y
+  and hat, then wheel ID, switch and encoder at HID_TAIL, the end of the
+  32 bytes report (or right after the hat with COMPACT_BUTTONS).
+*/
+#ifdef COMPACT_BUTTONS
+#define HID_TAIL 12
+#else
+#define HID_TAIL 32
+#endif
+uint8_t hid_data[HID_TAIL + 3];
 uint32_t max_delay = 150000; // overhead if below 120ms
 // 400 is too short with fanaleds
 
@@ -54,23 +80,46 @@ void setup();
 void loop();
 void idle();
 void init_wheel();
+#ifdef IS_USB
+void usbSchedule();
+void hidDrain();
+#endif
 
 /* Wheel inputs */
 void whClear();
 void whButton(uint8_t button, bool val);
+void whCommit();
+#ifndef IS_USB
+void whOutput(uint8_t button, bool val);
+#endif
+#ifdef HAS_DEBUG
+void debounceBenchmark();
+#endif
 void whStick(unsigned int x, unsigned int y);
 void whDoubleAxis(unsigned int x, unsigned int y);
 void whDoubleClutch(unsigned int x, unsigned int y);
 void whHat(int8_t val, bool is_csl);
 void whSetId(unsigned int val);
+void whSwitch(uint8_t val);
+void whEncoder(int8_t val);
+
+/* Lazy decoding */
+uint8_t frameChanged(const uint8_t* raw);
+typedef void (*rim_decoder_t)(const uint8_t* raw, uint8_t changed);
+void rimDecoder(wheel_type type, const uint8_t* raw);
+void decodeGt3Switches(const csw_in_t* in);
+
+/* CSL cluster scan */
+uint8_t cslStep();
+void cslDecode(uint8_t selector);
 
-csw_in_t csw_in;
+csw_in_t csw_in __attribute__((aligned(4)));
 csw_out_t csw_out;
 
 csl_in_t csl_in;
 csl_out_t csl_out;
 
-mcl_in_t mcl_in;
+mcl_in_t mcl_in __attribute__((aligned(4)));
 mcl_out_t mcl_out;
 
 bool bt_connected;
@@ -81,10 +130,55 @@ uint32_t timing_bt;
 uint32_t disp_timout;
 uint32_t usb_time;
 
-uint8_t hid_pck[7];
+// HID output packets (USB): newest one of each class, see hidDrain()
+#define HID_OUT_SIZE 8
+// Unified output packets, once the host asked for them (see hid_output())
+bool hid_unified = false;
+#define HID_IS_UNIFIED(data) (hid_unified && ((data)[2] & 0xFE) == 0xE0)
+#define HID_CLASSES 4 // unified, 7 seg, rumbles, rev lights
+uint8_t hid_pck[HID_CLASSES][HID_OUT_SIZE];
+uint8_t hid_pck_size[HID_CLASSES];
+
+/*
+  Eager debounce per button class: presses are reported at once and
+  only chatter after a press is locked out. Can be overridden with
+  -DEAGER_xxx=0/1 in the Makefile OPTIONS.
+*/
+#ifndef EAGER_PADDLES
+#define EAGER_PADDLES 1   // shifter paddles (15, 16)
+#endif
+#ifndef EAGER_FACE
+#define EAGER_FACE 0      // face buttons (1 to 14)
+#endif
+#ifndef EAGER_HAT
+#define EAGER_HAT 0       // hat switch
+#endif
+
+/*
+  Rotary encoder: HID reports each detent (button 17 or 18) is held
+  pressed, then released, and optional acceleration. Can be overridden
+  with -DROTARY_xxx=n in the Makefile OPTIONS.
+*/
+#ifndef ROTARY_HOLD_REPORTS
+#define ROTARY_HOLD_REPORTS 2
+#endif
+#ifndef ROTARY_ACCEL_MS
+#define ROTARY_ACCEL_MS 0     // window, 0: no acceleration
+#endif
+#ifndef ROTARY_ACCEL_FACTOR
+#define ROTARY_ACCEL_FACTOR 2 // detents counted per detent in the window
+#endif
 
-Debouncer * btDebncer = new Debouncer[89];
+// Buttons: raw state set by whButton(), debounced by whCommit()
+VerticalDebouncer btDebncer;
+uint32_t wh_raw[VD_WORDS];
+uint32_t wh_out[VD_WORDS];
+#ifdef IS_USB
+// USB report built by the wh* functions, handed over by whCommit()
+usb_joystick_report_t wh_report;
+#endif
 Debouncer hatDebncer = Debouncer();
+RotaryQueue rotary;
 
 byte rotary_debounce = 0;
 int8_t rotary_value = 0;
@@ -92,9 +186,37 @@ uint8_t main_link_id = 1;
 
 uint8_t clutch_max = 0xFF;
 
+// GT3 switch buttons pressed by the last frame (see decodeGt3Switches())
+uint8_t gt3_active[5];
+
+// GT3 clutch paddle modes (garbage[2] low nibble)
+#define CLUTCH_AXES     0 // two axes (any other value)
+#define CLUTCH_BITE     1 // bite point
+#define CLUTCH_ADVANCED 2 // bite point advanced
+
+// Lazy decoding: bytes 0-31 of the last frame decoded, and whether
+// the hat debouncer is still holding back a change (see frameChanged())
+uint32_t last_frame[8];
+uint32_t frame_session = 0xFFFFFFFF;
+bool wh_pending = false;
+
+// Decode kernel for the rim attached, picked by rimDecoder()
+void decodeNone(const uint8_t* raw, uint8_t changed) {}
+rim_decoder_t rim_decode = decodeNone;
+wheel_type decoder_type = NO_WHEEL;
+uint8_t decoder_id = NO_RIM;
+uint8_t decoder_clutch = CLUTCH_AXES;
+
+// Frame words (4 bytes each) used by each decode stage
+#define FRAME_ALL  0xFF
+#define FRAME_KIND 0x09 // id, garbage[0-3] (GT3 clutch mode)
+#define FRAME_CORE 0x0B // id, buttons, axes, encoder, garbage[0-3]
+#define FRAME_HUB  0x05 // id, btnHub, btnPS
+
 
 void setup() {
   fsetup();
+  mapReset();
 
   /*
     8 Extra Buttons
@@ -108,9 +230,17 @@ void setup() {
 
   // debounce timer for hat switch
   hatDebncer.interval(50);
-  // debounce timer for rotary encoder
-  btDebncer[17].interval(30);
-  btDebncer[18].interval(30);
+  // rotary encoder: paced by its queue, not debounced
+  btDebncer.interval(17, 0);
+  btDebncer.interval(18, 0);
+  rotary.hold(ROTARY_HOLD_REPORTS);
+  rotary.acceleration(ROTARY_ACCEL_MS, ROTARY_ACCEL_FACTOR);
+
+  // eager debounce per button class (see EAGER_* above)
+  hatDebncer.eager(EAGER_HAT);
+  for (uint8_t b = 1; b <= 14; b++) btDebncer.eager(b, EAGER_FACE);
+  btDebncer.eager(15, EAGER_PADDLES);
+  btDebncer.eager(16, EAGER_PADDLES);
 
 
   /* WT12 */
@@ -129,13 +259,16 @@ void setup() {
 
     // prebuild HID packet
     hid_data[0] = 0x9f;
-    hid_data[1] = 0x21;
+    hid_data[1] = sizeof(hid_data) - 2;
     hid_data[2] = 0xa1;
 
     in_changed = false;
 
   #else
     Joystick.useManualSend(true);
+    #ifdef USB_SYNC_LEAD
+      usbSyncBegin();
+    #endif
   #endif // IS_USB
   whClear();
 
@@ -160,6 +293,12 @@ void setup() {
       /* code */
     }
 
+    #ifdef CRC8_HW
+    crc8SelfTest();
+    #endif
+    realignBenchmark();
+    debounceBenchmark();
+
     Serial.println("check for active connection...");
   #endif
 
@@ -178,23 +317,41 @@ void setup() {
 
 
 void loop() {
+  uint8_t changed;
 
   if(bt_connected) {
     #ifdef IS_USB
-      // Fetching HID packet
-      uint16_t hid_size;
-      hid_size = Joystick.recv(&hid_pck, 0);
-      if(hid_size > 0) hid_output(1, hid_size, hid_pck);
+      // Fetching HID packets
+      hidDrain();
+
+      #ifdef USB_SYNC_LEAD
+        // sample the rim and queue the report just before the next poll
+        if (!usbSyncDue()) return;
+      #endif
     #endif
 
 
     switch(detectWheelType()) {
       case CSW_WHEEL:
+        // SPI timing for this rim (a few loops on first insertion)
+        if (!rimCalibrate(CSW_WHEEL)) break;
+
         // csw stuff
         // Read Fanatec Packet
 
         //csw_out.raw[9] = 0x0F; // xbox light
-        transferCswData(&csw_out, &csw_in, sizeof(csw_out.raw));
+        #ifdef RIM_SAMPLE_RATE
+        samplerStart(CSW_WHEEL);
+        samplerWrite(csw_out.raw, sizeof(csw_out.raw));
+        samplerRead(csw_in.raw, sizeof(csw_in.raw));
+        #else
+        #ifdef RIM_SPI_DMA
+        // frame still clocking: decode it on a later loop
+        if (!rimFrameReady()) break;
+        #endif
+        // dropped frame: the encoder did not move
+        if (!transferCswData(&csw_out, &csw_in, sizeof(csw_out.raw))) csw_in.encoder = 0;
+        #endif
         init_wheel();
 
         #ifdef HAS_DEBUG
@@ -207,362 +364,58 @@ void loop() {
             Serial.println();
         #endif
 
-        // Wheel ID
-        whSetId(csw_in.id);
-
-        // Left stick
-        whStick(csw_in.axisX, csw_in.axisY);
-
-        // All buttons
-        whButton(1, csw_in.buttons[0] & 0x80); // first top right
-        whButton(2, csw_in.buttons[0] & 0x40); // middle right
-        whButton(3, csw_in.buttons[0] & 0x20); // second top right
-        whButton(4, csw_in.buttons[0] & 0x10); // bottom right
-        whButton(5, csw_in.buttons[1] & 0x80); // third center
-        whButton(6, csw_in.buttons[1] & 0x40); // first center
-        whButton(7, csw_in.buttons[1] & 0x20); // middle left
-        whButton(9, csw_in.buttons[1] & 0x04); // bottom left
-        whButton(11, csw_in.buttons[2] & 0x08); // second center
-        whButton(12, csw_in.buttons[2] & 0x04); // stick button
-
-        // paddles shitfer
-        whButton(15, csw_in.buttons[1] & 0x08); // left
-        whButton(16, csw_in.buttons[1] & 0x01); // right
-
-        rotary_value = csw_in.encoder;
-
-        if(csw_in.id != CSLMCLGT3){
-          whButton(8, csw_in.buttons[1] & 0x10); // first top left
-          whButton(10, csw_in.buttons[1] & 0x02); // second top left
-          whButton(13, csw_in.buttons[2] & 0x02); // hat button
-          whButton(14, csw_in.buttons[2] & 0x20); // display button
-
-
-
-          whButton(17, rotary_value == -1); // left
-          whButton(18, rotary_value == 1); // right
-
-        }
-
-
-        if(csw_in.id == UNIHUB || csw_in.id == XBOXHUB){
-          // Uni Hub extra buttons
-          // BUT_5 array (optional 3 buttons)
-          whButton(19, csw_in.btnHub[0] & 0x08);
-          whButton(20, csw_in.btnHub[0] & 0x10);
-          whButton(21, csw_in.btnHub[0] & 0x20);
-
-          // Playstation buttons
-          whButton(22, csw_in.btnPS[0] & 0x01);
-          whButton(23, csw_in.btnPS[0] & 0x02);
-          whButton(24, csw_in.btnPS[0] & 0x04);
-          whButton(25, csw_in.btnPS[0] & 0x08);
-          whButton(26, csw_in.btnPS[0] & 0x10);
-          whButton(27, csw_in.btnPS[0] & 0x20);
-          whButton(28, csw_in.btnPS[0] & 0x40);
-          whButton(29, csw_in.btnPS[0] & 0x80);
-
-          whButton(30, csw_in.btnPS[1] & 0x01);
-          whButton(31, csw_in.btnPS[1] & 0x02);
-          whButton(32, csw_in.btnPS[1] & 0x04);
-          whButton(33, csw_in.btnPS[1] & 0x08);
-          whButton(34, csw_in.btnPS[1] & 0x10);
-          whButton(35, csw_in.btnPS[1] & 0x20);
-          whButton(36, csw_in.btnPS[1] & 0x40);
-          whButton(37, csw_in.btnPS[1] & 0x80);
-        }
-
-        if(csw_in.id == XBOXHUB){
-          // Xbox Hub has 1 extra button
-          whButton(38, csw_in.btnHub[1] & 0x08);
-        }
-
-
-        whHat(csw_in.buttons[0] & 0x0f, false);
-
-        // Serial.println(String("button: ") + hid_data[3]);
-
-
-        if(csw_in.id == CSLMCLGT3){
-        whButton(8, (csw_in.buttons[1] & 0x10) && ((csw_in.garbage[3] & 0xF0) == 0x10)); // switch left up
-        whButton(19, (csw_in.buttons[2] & 0x80) && ((csw_in.garbage[3] & 0xF0) == 0x10)); // switch left down
-        whButton(10, (csw_in.buttons[1] & 0x02) && ((csw_in.garbage[3] & 0xF0) == 0x10)); // switch right up
-        whButton(20, (csw_in.buttons[2] & 0x40) && ((csw_in.garbage[3] & 0xF0) == 0x10)); // switch right down
-
-        whButton(33, (csw_in.buttons[1] & 0x10) && ((csw_in.garbage[3] & 0xF0) == 0x20)); // switch left up
-        whButton(34, (csw_in.buttons[2] & 0x80) && ((csw_in.garbage[3] & 0xF0) == 0x20)); // switch left down
-        whButton(35, (csw_in.buttons[1] & 0x02) && ((csw_in.garbage[3] & 0xF0) == 0x20)); // switch right up
-        whButton(36, (csw_in.buttons[2] & 0x40) && ((csw_in.garbage[3] & 0xF0) == 0x20)); // switch right down
-
-        whButton(37, (csw_in.buttons[1] & 0x10) && ((csw_in.garbage[3] & 0xF0) == 0x30)); // switch left up
-        whButton(38, (csw_in.buttons[2] & 0x80) && ((csw_in.garbage[3] & 0xF0) == 0x30)); // switch left down
-        whButton(39, (csw_in.buttons[1] & 0x02) && ((csw_in.garbage[3] & 0xF0) == 0x30)); // switch right up
-        whButton(40, (csw_in.buttons[2] & 0x40) && ((csw_in.garbage[3] & 0xF0) == 0x30)); // switch right down
-
-        whButton(41, (csw_in.buttons[1] & 0x10) && ((csw_in.garbage[3] & 0xF0) == 0x40)); // switch left up
-        whButton(42, (csw_in.buttons[2] & 0x80) && ((csw_in.garbage[3] & 0xF0) == 0x40)); // switch left down
-        whButton(43, (csw_in.buttons[1] & 0x02) && ((csw_in.garbage[3] & 0xF0) == 0x40)); // switch right up
-        whButton(44, (csw_in.buttons[2] & 0x40) && ((csw_in.garbage[3] & 0xF0) == 0x40)); // switch right down
-
-        whButton(45, (csw_in.buttons[1] & 0x10) && ((csw_in.garbage[3] & 0xF0) == 0x50)); // switch left up
-        whButton(46, (csw_in.buttons[2] & 0x80) && ((csw_in.garbage[3] & 0xF0) == 0x50)); // switch left down
-        whButton(47, (csw_in.buttons[1] & 0x02) && ((csw_in.garbage[3] & 0xF0) == 0x50)); // switch right up
-        whButton(48, (csw_in.buttons[2] & 0x40) && ((csw_in.garbage[3] & 0xF0) == 0x50)); // switch right down
-
-        whButton(49, (csw_in.buttons[1] & 0x10) && ((csw_in.garbage[3] & 0xF0) == 0x60)); // switch left up
-        whButton(50, (csw_in.buttons[2] & 0x80) && ((csw_in.garbage[3] & 0xF0) == 0x60)); // switch left down
-        whButton(51, (csw_in.buttons[1] & 0x02) && ((csw_in.garbage[3] & 0xF0) == 0x60)); // switch right up
-        whButton(52, (csw_in.buttons[2] & 0x40) && ((csw_in.garbage[3] & 0xF0) == 0x60)); // switch right down
-
-        whButton(53, (csw_in.buttons[1] & 0x10) && ((csw_in.garbage[3] & 0xF0) == 0x70)); // switch left up
-        whButton(54, (csw_in.buttons[2] & 0x80) && ((csw_in.garbage[3] & 0xF0) == 0x70)); // switch left down
-        whButton(55, (csw_in.buttons[1] & 0x02) && ((csw_in.garbage[3] & 0xF0) == 0x70)); // switch right up
-        whButton(56, (csw_in.buttons[2] & 0x40) && ((csw_in.garbage[3] & 0xF0) == 0x70)); // switch right down
-
-        whButton(57, (csw_in.buttons[1] & 0x10) && ((csw_in.garbage[3] & 0xF0) == 0x80)); // switch left up
-        whButton(58, (csw_in.buttons[2] & 0x80) && ((csw_in.garbage[3] & 0xF0) == 0x80)); // switch left down
-        whButton(59, (csw_in.buttons[1] & 0x02) && ((csw_in.garbage[3] & 0xF0) == 0x80)); // switch right up
-        whButton(60, (csw_in.buttons[2] & 0x40) && ((csw_in.garbage[3] & 0xF0) == 0x80)); // switch right down
-
-        whButton(61, (csw_in.buttons[1] & 0x10) && ((csw_in.garbage[3] & 0xF0) == 0x90)); // switch left up
-        whButton(62, (csw_in.buttons[2] & 0x80) && ((csw_in.garbage[3] & 0xF0) == 0x90)); // switch left down
-        whButton(63, (csw_in.buttons[1] & 0x02) && ((csw_in.garbage[3] & 0xF0) == 0x90)); // switch right up
-        whButton(64, (csw_in.buttons[2] & 0x40) && ((csw_in.garbage[3] & 0xF0) == 0x90)); // switch right down
-
-        whButton(65, (csw_in.buttons[1] & 0x10) && ((csw_in.garbage[3] & 0xF0) == 0xA0)); // switch left up
-        whButton(66, (csw_in.buttons[2] & 0x80) && ((csw_in.garbage[3] & 0xF0) == 0xA0)); // switch left down
-        whButton(67, (csw_in.buttons[1] & 0x02) && ((csw_in.garbage[3] & 0xF0) == 0xA0)); // switch right up
-        whButton(68, (csw_in.buttons[2] & 0x40) && ((csw_in.garbage[3] & 0xF0) == 0xA0)); // switch right down
-
-        whButton(69, (csw_in.buttons[1] & 0x10) && ((csw_in.garbage[3] & 0xF0) == 0xB0)); // switch left up
-        whButton(70, (csw_in.buttons[2] & 0x80) && ((csw_in.garbage[3] & 0xF0) == 0xB0)); // switch left down
-        whButton(71, (csw_in.buttons[1] & 0x02) && ((csw_in.garbage[3] & 0xF0) == 0xB0)); // switch right up
-        whButton(72, (csw_in.buttons[2] & 0x40) && ((csw_in.garbage[3] & 0xF0) == 0xB0)); // switch right down
-
-        whButton(73, (csw_in.buttons[1] & 0x10) && ((csw_in.garbage[3] & 0xF0) == 0xC0)); // switch left up
-        whButton(74, (csw_in.buttons[2] & 0x80) && ((csw_in.garbage[3] & 0xF0) == 0xC0)); // switch left down
-        whButton(75, (csw_in.buttons[1] & 0x02) && ((csw_in.garbage[3] & 0xF0) == 0xC0)); // switch right up
-        whButton(76, (csw_in.buttons[2] & 0x40) && ((csw_in.garbage[3] & 0xF0) == 0xC0)); // switch right down
-
-        whButton(14, csw_in.buttons[2] & 0x02); // xbox
-
-        if ((csw_in.garbage[2] & 0x0F) == 0x02 && !csw_in.axisX) // left clutch fully pressed
-        {
-          clutch_max = constrain(clutch_max + rotary_value, 0, 0xFF);
-        } else {
-          whButton(17, rotary_value <= -1); // left
-          whButton(18, rotary_value >= 1); // right
-        }
-
-        // clutch paddle
-        switch(csw_in.garbage[2] & 0x0F) {
-          case 0x01:
-            // bite point
-            whDoubleClutch(~csw_in.axisX, ~csw_in.axisY);
-            break;
-          case 0x02:
-            // bite point advanced
-            whDoubleClutch(map(~csw_in.axisX & 0xFF,0,0xFF,0,clutch_max) , ~csw_in.axisY&0xff);
-            break;
-          default:
-          whDoubleAxis(~csw_in.axisX, ~csw_in.axisY);
-        }
-
-        //whButton(11, mcl_in.buttons[2] & 0x20); // display button
-
-          whButton(21, ((csw_in.garbage[3] & 0x0f) == 0x01) && !((csw_in.buttons[2] & 0x20) == 0x20));
-          whButton(22, ((csw_in.garbage[3] & 0x0f) == 0x02) && !((csw_in.buttons[2] & 0x20) == 0x20));
-          whButton(23, ((csw_in.garbage[3] & 0x0f) == 0x03) && !((csw_in.buttons[2] & 0x20) == 0x20));
-          whButton(24, ((csw_in.garbage[3] & 0x0f) == 0x04) && !((csw_in.buttons[2] & 0x20) == 0x20));
-          whButton(25, ((csw_in.garbage[3] & 0x0f) == 0x05) && !((csw_in.buttons[2] & 0x20) == 0x20));
-          whButton(26, ((csw_in.garbage[3] & 0x0f) == 0x06) && !((csw_in.buttons[2] & 0x20) == 0x20));
-          whButton(27, ((csw_in.garbage[3] & 0x0f) == 0x07) && !((csw_in.buttons[2] & 0x20) == 0x20));
-          whButton(28, ((csw_in.garbage[3] & 0x0f) == 0x08) && !((csw_in.buttons[2] & 0x20) == 0x20));
-          whButton(29, ((csw_in.garbage[3] & 0x0f) == 0x09) && !((csw_in.buttons[2] & 0x20) == 0x20));
-          whButton(30, ((csw_in.garbage[3] & 0x0f) == 0x0A) && !((csw_in.buttons[2] & 0x20) == 0x20));
-          whButton(31, ((csw_in.garbage[3] & 0x0f) == 0x0B) && !((csw_in.buttons[2] & 0x20) == 0x20));
-          whButton(32, ((csw_in.garbage[3] & 0x0f) == 0x0C) && !((csw_in.buttons[2] & 0x20) == 0x20));
-
-
-          whStick(0, 0);
-        }
-
-
+        // Decode only what changed since the last frame
+        changed = frameChanged(csw_in.raw);
+        // the encoder is a delta, every frame counts
+        if (csw_in.encoder) changed = FRAME_ALL;
+        if (changed & FRAME_KIND) rimDecoder(CSW_WHEEL, csw_in.raw);
+        rim_decode(csw_in.raw, changed);
         break;
       case CSL_WHEEL:
+        // SPI timing for this rim (a few loops on first insertion)
+        if (!rimCalibrate(CSL_WHEEL)) break;
+
         // csl stuff
-        transferCslData(&csl_out, &csl_in, sizeof(csl_out.raw), 0x00);
         whSetId(CSLP1XBOX);
         init_wheel();
 
-        // Joystick / 1st disp
-        csl_out.disp = csw7segToCsl(csw_out.disp[0]);
-        transferCslData(&csl_out, &csl_in, sizeof(csl_out.raw), 0x41);
-        whHat(csl_in.buttons & 0x1E, true);
-        whButton(13, csl_in.buttons & 0x01); // hat button
-
-        // Right Line / 2st disp
-        csl_out.disp = csw7segToCsl(csw_out.disp[1]);
-        transferCslData(&csl_out, &csl_in, sizeof(csl_out.raw), 0x02);
-        whButton(11, csl_in.buttons & 0x01); // wrench
-        whButton(5, csl_in.buttons & 0x04); // RT
-        whButton(14, csl_in.buttons & 0x08); // xbox
-        whButton(6, csl_in.buttons & 0x10); // RSB
-
-        // Left cluster / 3st disp
-        csl_out.disp = csw7segToCsl(csw_out.disp[2]);
-        transferCslData(&csl_out, &csl_in, sizeof(csl_out.raw), 0x44);
-        whButton(15, csl_in.buttons & 0x01); // left paddle
-        whButton(9, csl_in.buttons & 0x02); // lines
-        whButton(10, csl_in.buttons & 0x04); // squares
-        whButton(8, csl_in.buttons & 0x08); // LSB
-        whButton(7, csl_in.buttons & 0x10); // LT
-
-        // Right cluster / RGB Led
-        csl_out.disp = cswLedsToCsl(csw_out.leds);
-        transferCslData(&csl_out, &csl_in, sizeof(csl_out.raw), 0x08);
-        whButton(16, csl_in.buttons & 0x01); // right paddle
-        whButton(1, csl_in.buttons & 0x02); // B
-        whButton(2, csl_in.buttons & 0x04); // A
-        whButton(3, csl_in.buttons & 0x08); // Y
-        whButton(4, csl_in.buttons & 0x10); // X
+        #ifdef CSL_ROUND_ROBIN
+        // one cluster per loop
+        cslStep();
+        #else
+        // every cluster, until the last one's reply is in
+        while (cslStep() != 0x08) ;
+        #endif
 
         whStick(0, 0);
 
         break;
       case MCL_WHEEL:
+        // SPI timing for this rim (a few loops on first insertion)
+        if (!rimCalibrate(MCL_WHEEL)) break;
+
         // McLaren GT3
 
-        transferMclData(&mcl_out, &mcl_in, sizeof(mcl_out.raw));
+        #ifdef RIM_SAMPLE_RATE
+        samplerStart(MCL_WHEEL);
+        samplerWrite(mcl_out.raw, sizeof(mcl_out.raw));
+        samplerRead(mcl_in.raw, sizeof(mcl_in.raw));
+        #else
+        #ifdef RIM_SPI_DMA
+        // frame still clocking: decode it on a later loop
+        if (!rimFrameReady()) break;
+        #endif
+        // dropped frame: the encoder did not move
+        if (!transferMclData(&mcl_out, &mcl_in, sizeof(mcl_out.raw))) mcl_in.encoder = 0;
+        #endif
         init_wheel();
 
-        // Wheel ID
-        whSetId(mcl_in.id);
-
-        whHat(mcl_in.buttons[0] & 0x0f, false);
-
-        // All buttons
-        whButton(1, mcl_in.buttons[0] & 0x80); // Y
-        whButton(2, mcl_in.buttons[0] & 0x40); // B
-        whButton(3, mcl_in.buttons[0] & 0x20); // X
-        whButton(4, mcl_in.buttons[0] & 0x10); // A
-        whButton(5, mcl_in.buttons[1] & 0x80); // P
-        whButton(6, mcl_in.buttons[1] & 0x40); // N
-        whButton(7, mcl_in.buttons[1] & 0x20); // LSB
-
-
-        whButton(9, mcl_in.buttons[1] & 0x04); // RSB
-
-        whButton(8, (mcl_in.buttons[1] & 0x10) && ((mcl_in.garbage[3] & 0xF0) == 0x10)); // switch left up
-        whButton(19, (mcl_in.buttons[2] & 0x80) && ((mcl_in.garbage[3] & 0xF0) == 0x10)); // switch left down
-        whButton(10, (mcl_in.buttons[1] & 0x02) && ((mcl_in.garbage[3] & 0xF0) == 0x10)); // switch right up
-        whButton(20, (mcl_in.buttons[2] & 0x40) && ((mcl_in.garbage[3] & 0xF0) == 0x10)); // switch right down
-
-        whButton(33, (mcl_in.buttons[1] & 0x10) && ((mcl_in.garbage[3] & 0xF0) == 0x20)); // switch left up
-        whButton(34, (mcl_in.buttons[2] & 0x80) && ((mcl_in.garbage[3] & 0xF0) == 0x20)); // switch left down
-        whButton(35, (mcl_in.buttons[1] & 0x02) && ((mcl_in.garbage[3] & 0xF0) == 0x20)); // switch right up
-        whButton(36, (mcl_in.buttons[2] & 0x40) && ((mcl_in.garbage[3] & 0xF0) == 0x20)); // switch right down
-
-        whButton(37, (mcl_in.buttons[1] & 0x10) && ((mcl_in.garbage[3] & 0xF0) == 0x30)); // switch left up
-        whButton(38, (mcl_in.buttons[2] & 0x80) && ((mcl_in.garbage[3] & 0xF0) == 0x30)); // switch left down
-        whButton(39, (mcl_in.buttons[1] & 0x02) && ((mcl_in.garbage[3] & 0xF0) == 0x30)); // switch right up
-        whButton(40, (mcl_in.buttons[2] & 0x40) && ((mcl_in.garbage[3] & 0xF0) == 0x30)); // switch right down
-
-        whButton(41, (mcl_in.buttons[1] & 0x10) && ((mcl_in.garbage[3] & 0xF0) == 0x40)); // switch left up
-        whButton(42, (mcl_in.buttons[2] & 0x80) && ((mcl_in.garbage[3] & 0xF0) == 0x40)); // switch left down
-        whButton(43, (mcl_in.buttons[1] & 0x02) && ((mcl_in.garbage[3] & 0xF0) == 0x40)); // switch right up
-        whButton(44, (mcl_in.buttons[2] & 0x40) && ((mcl_in.garbage[3] & 0xF0) == 0x40)); // switch right down
-
-        whButton(45, (mcl_in.buttons[1] & 0x10) && ((mcl_in.garbage[3] & 0xF0) == 0x50)); // switch left up
-        whButton(46, (mcl_in.buttons[2] & 0x80) && ((mcl_in.garbage[3] & 0xF0) == 0x50)); // switch left down
-        whButton(47, (mcl_in.buttons[1] & 0x02) && ((mcl_in.garbage[3] & 0xF0) == 0x50)); // switch right up
-        whButton(48, (mcl_in.buttons[2] & 0x40) && ((mcl_in.garbage[3] & 0xF0) == 0x50)); // switch right down
-
-        whButton(49, (mcl_in.buttons[1] & 0x10) && ((mcl_in.garbage[3] & 0xF0) == 0x60)); // switch left up
-        whButton(50, (mcl_in.buttons[2] & 0x80) && ((mcl_in.garbage[3] & 0xF0) == 0x60)); // switch left down
-        whButton(51, (mcl_in.buttons[1] & 0x02) && ((mcl_in.garbage[3] & 0xF0) == 0x60)); // switch right up
-        whButton(52, (mcl_in.buttons[2] & 0x40) && ((mcl_in.garbage[3] & 0xF0) == 0x60)); // switch right down
-
-        whButton(53, (mcl_in.buttons[1] & 0x10) && ((mcl_in.garbage[3] & 0xF0) == 0x70)); // switch left up
-        whButton(54, (mcl_in.buttons[2] & 0x80) && ((mcl_in.garbage[3] & 0xF0) == 0x70)); // switch left down
-        whButton(55, (mcl_in.buttons[1] & 0x02) && ((mcl_in.garbage[3] & 0xF0) == 0x70)); // switch right up
-        whButton(56, (mcl_in.buttons[2] & 0x40) && ((mcl_in.garbage[3] & 0xF0) == 0x70)); // switch right down
-
-        whButton(57, (mcl_in.buttons[1] & 0x10) && ((mcl_in.garbage[3] & 0xF0) == 0x80)); // switch left up
-        whButton(58, (mcl_in.buttons[2] & 0x80) && ((mcl_in.garbage[3] & 0xF0) == 0x80)); // switch left down
-        whButton(59, (mcl_in.buttons[1] & 0x02) && ((mcl_in.garbage[3] & 0xF0) == 0x80)); // switch right up
-        whButton(60, (mcl_in.buttons[2] & 0x40) && ((mcl_in.garbage[3] & 0xF0) == 0x80)); // switch right down
-
-        whButton(61, (mcl_in.buttons[1] & 0x10) && ((mcl_in.garbage[3] & 0xF0) == 0x90)); // switch left up
-        whButton(62, (mcl_in.buttons[2] & 0x80) && ((mcl_in.garbage[3] & 0xF0) == 0x90)); // switch left down
-        whButton(63, (mcl_in.buttons[1] & 0x02) && ((mcl_in.garbage[3] & 0xF0) == 0x90)); // switch right up
-        whButton(64, (mcl_in.buttons[2] & 0x40) && ((mcl_in.garbage[3] & 0xF0) == 0x90)); // switch right down
-
-        whButton(65, (mcl_in.buttons[1] & 0x10) && ((mcl_in.garbage[3] & 0xF0) == 0xA0)); // switch left up
-        whButton(66, (mcl_in.buttons[2] & 0x80) && ((mcl_in.garbage[3] & 0xF0) == 0xA0)); // switch left down
-        whButton(67, (mcl_in.buttons[1] & 0x02) && ((mcl_in.garbage[3] & 0xF0) == 0xA0)); // switch right up
-        whButton(68, (mcl_in.buttons[2] & 0x40) && ((mcl_in.garbage[3] & 0xF0) == 0xA0)); // switch right down
-
-        whButton(69, (mcl_in.buttons[1] & 0x10) && ((mcl_in.garbage[3] & 0xF0) == 0xB0)); // switch left up
-        whButton(70, (mcl_in.buttons[2] & 0x80) && ((mcl_in.garbage[3] & 0xF0) == 0xB0)); // switch left down
-        whButton(71, (mcl_in.buttons[1] & 0x02) && ((mcl_in.garbage[3] & 0xF0) == 0xB0)); // switch right up
-        whButton(72, (mcl_in.buttons[2] & 0x40) && ((mcl_in.garbage[3] & 0xF0) == 0xB0)); // switch right down
-
-        whButton(73, (mcl_in.buttons[1] & 0x10) && ((mcl_in.garbage[3] & 0xF0) == 0xC0)); // switch left up
-        whButton(74, (mcl_in.buttons[2] & 0x80) && ((mcl_in.garbage[3] & 0xF0) == 0xC0)); // switch left down
-        whButton(75, (mcl_in.buttons[1] & 0x02) && ((mcl_in.garbage[3] & 0xF0) == 0xC0)); // switch right up
-        whButton(76, (mcl_in.buttons[2] & 0x40) && ((mcl_in.garbage[3] & 0xF0) == 0xC0)); // switch right down
-
-        whButton(12, mcl_in.buttons[2] & 0x04); // hat button
-        whButton(14, mcl_in.buttons[2] & 0x02); // xbox
-
-        // paddles shitfer
-        whButton(15, mcl_in.buttons[1] & 0x08); // left
-        whButton(16, mcl_in.buttons[1] & 0x01); // right
-
-
-        rotary_value = mcl_in.encoder;
-
-        if ((mcl_in.garbage[2] & 0x0F) == 0x02 && !mcl_in.axisX) // left clutch fully pressed
-        {
-          clutch_max = constrain(clutch_max + rotary_value, 0, 0xFF);
-        } else {
-          whButton(17, rotary_value <= -1); // left
-          whButton(18, rotary_value >= 1); // right
-        }
-
-        // clutch paddle
-        switch(mcl_in.garbage[2] & 0x0F) {
-          case 0x01:
-            // bite point
-            whDoubleClutch(~mcl_in.axisX, ~mcl_in.axisY);
-            break;
-          case 0x02:
-            // bite point advanced
-            whDoubleClutch(map(~mcl_in.axisX & 0xFF,0,0xFF,0,clutch_max) , ~mcl_in.axisY&0xff);
-            break;
-          default:
-          whDoubleAxis(~mcl_in.axisX, ~mcl_in.axisY);
-        }
-
-        //whButton(11, mcl_in.buttons[2] & 0x20); // display button
-
-          whButton(21, ((mcl_in.garbage[3] & 0x0f) == 0x01) && !((mcl_in.buttons[2] & 0x20) == 0x20));
-          whButton(22, ((mcl_in.garbage[3] & 0x0f) == 0x02) && !((mcl_in.buttons[2] & 0x20) == 0x20));
-          whButton(23, ((mcl_in.garbage[3] & 0x0f) == 0x03) && !((mcl_in.buttons[2] & 0x20) == 0x20));
-          whButton(24, ((mcl_in.garbage[3] & 0x0f) == 0x04) && !((mcl_in.buttons[2] & 0x20) == 0x20));
-          whButton(25, ((mcl_in.garbage[3] & 0x0f) == 0x05) && !((mcl_in.buttons[2] & 0x20) == 0x20));
-          whButton(26, ((mcl_in.garbage[3] & 0x0f) == 0x06) && !((mcl_in.buttons[2] & 0x20) == 0x20));
-          whButton(27, ((mcl_in.garbage[3] & 0x0f) == 0x07) && !((mcl_in.buttons[2] & 0x20) == 0x20));
-          whButton(28, ((mcl_in.garbage[3] & 0x0f) == 0x08) && !((mcl_in.buttons[2] & 0x20) == 0x20));
-          whButton(29, ((mcl_in.garbage[3] & 0x0f) == 0x09) && !((mcl_in.buttons[2] & 0x20) == 0x20));
-          whButton(30, ((mcl_in.garbage[3] & 0x0f) == 0x0A) && !((mcl_in.buttons[2] & 0x20) == 0x20));
-          whButton(31, ((mcl_in.garbage[3] & 0x0f) == 0x0B) && !((mcl_in.buttons[2] & 0x20) == 0x20));
-          whButton(32, ((mcl_in.garbage[3] & 0x0f) == 0x0C) && !((mcl_in.buttons[2] & 0x20) == 0x20));
-
-
-          whStick(0, 0);
-
+        // Decode only what changed since the last frame
+        changed = frameChanged(mcl_in.raw);
+        // the encoder is a delta, every frame counts
+        if (mcl_in.encoder) changed = FRAME_ALL;
+        if (changed & FRAME_KIND) rimDecoder(MCL_WHEEL, mcl_in.raw);
+        rim_decode(mcl_in.raw, changed);
 
         #ifdef HAS_DEBUG
            Serial.print("MCL_IN:");
@@ -576,57 +429,41 @@ void loop() {
 
         break;
       default:
-        // no wheel  ?
+        // no wheel (yet), detection goes on in the background
         whClear();
-        delay(10);
     }
 
+    // Rotary encoder, one detent at a time
+    whButton(17, rotary.value() < 0); // left
+    whButton(18, rotary.value() > 0); // right
+    whEncoder(rotary.relative());
+
     // Need more inputs?
     // 8 Extra Buttons (pins 2 to 9 -> 41 to 48)
     for (int i = 0; i < 8; ++i)
     {
       whButton(77+i, !digitalRead(2+i));
     }
+    whCommit();
 
     // Send HID report (all inputs)
     #ifdef IS_USB
-      uint32_t now = micros();
-      if (now >= usb_time)
-      {
-        uint32_t delta_t = now - usb_time;
-        #ifdef HAS_DEBUG
-          Serial.println(String("usb loop time : ") + delta_t);
-        #endif
-
-        if (delta_t >= MAX_SPEED)
-        {
-          // delayMicroseconds(MAX_SPEED - delta_t);
-          #ifdef HAS_DEBUG
-              Serial.println(String("usb loop time pre send: ") + (micros() - usb_time));
-          #endif
-          Joystick.send_now();
-          #ifdef HAS_DEBUG
-              Serial.println(String("usb loop time post send: ") + (micros() - usb_time));
-          #endif
-          usb_time = micros();
-        }
-        else {
-          #ifdef HAS_DEBUG
-              Serial.println(String("skipping report"));
-          #endif
-        }
-      }
-
-
+      #ifdef HAS_DEBUG
+        Serial.println(String("rim frame time (") + rim_spi_backend + "): " + rim_frame_us);
+        Serial.println(String("rim frames good/bad/realigned: ") + rim_stats.good + "/" + rim_stats.bad + "/" + rim_stats.realigned);
+        Serial.println(String("rotary queue overflows: ") + rotary.overflows());
+      #endif
+      usbSchedule();
 
       // rotary_debounce = 0;
     #else
       uint32_t timout;
       timout = micros() - timing;
-        if(timout > max_delay || (in_changed && timout > 10000))
+        if(timout > max_delay || ((in_changed || rotary.busy()) && timout > 10000))
         {
           // hid_data[3] = (hid_data[3]+1)&0xff;
           iwrap_send_data(main_link_id, sizeof(hid_data), hid_data, iwrap_mode);
+          rotary.sent();
           timing = micros();
           #ifdef HAS_DEBUG
             if (rotary_debounce!=0)Serial.println(String("RESET!!!!!!!!!ROTARY : ") + rotary_value);
@@ -651,11 +488,137 @@ void loop() {
   idle();
 }
 
+#ifdef IS_USB
+// Command class of a HID output packet (-1: not coalesced)
+static int8_t hidClass(const uint8_t *data) {
+  if(HID_IS_UNIFIED(data)) return 0;               // all outputs
+  if(data[2] == 0x01 && data[3] == 0x02) return 1; // 7 seg
+  if(data[2] == 0x01 && data[3] == 0x03) return 2; // rumbles
+  if(data[2] == 0x08) return 3;                    // rev lights
+  return -1;
+}
+
+// Read every HID output packet waiting, then apply only the newest one
+// of each class, so a burst from the host lands in the next rim frame.
+// A unified packet supersedes every legacy one received before it.
+void hidDrain() {
+  uint8_t pck[HID_OUT_SIZE];
+  uint16_t size;
+
+  memset(hid_pck_size, 0, sizeof(hid_pck_size));
+  while ((size = Joystick.recv(pck, 0)) > 0) {
+    int8_t c = hidClass(pck);
+    if (c < 0) {
+      hid_output(1, size, pck);
+      continue;
+    }
+    if (c == 0) memset(hid_pck_size, 0, sizeof(hid_pck_size));
+    memcpy(hid_pck[c], pck, HID_OUT_SIZE);
+    hid_pck_size[c] = size;
+  }
+  for (uint8_t c=0; c<HID_CLASSES; c++) {
+    if (hid_pck_size[c]) hid_output(1, hid_pck_size[c], hid_pck[c]);
+  }
+}
+
+// Submit the joystick report if it changed, the USB stack repeats it at
+// the host's idle rate (with USB_SYNC_LEAD, also while the sync needs
+// reports to see the polls). Never waits for the host: a report it has
+// not taken yet is replaced.
+void usbSchedule() {
+  uint32_t since = micros() - usb_time;
+  bool changed = rotary.busy() || memcmp(usb_joystick_data, Joystick.submitted(), sizeof(usb_joystick_report_t));
+  #ifdef USB_SYNC_LEAD
+    bool keepalive = !changed && !Joystick.pending() && usbSyncWanted();
+  #else
+    const bool keepalive = false;
+  #endif
+
+  if (!(changed || keepalive) || since < USB_MIN_INTERVAL) return;
+  // each rotary detent step must reach the host, don't replace it
+  if (rotary.busy() && Joystick.pending()) return;
+
+  Joystick.submit();
+  rotary.sent();
+  #ifdef USB_SYNC_LEAD
+    usbSyncQueued();
+  #endif
+  #ifdef HAS_DEBUG
+    Serial.println(String("usb report after ") + since + (keepalive ? " (keepalive), " : ", ") + Joystick.sequence() + " reports, "
+      + Joystick.repeats() + " repeats (idle " + Joystick.idleRate() + "ms)");
+    #ifdef USB_SYNC_LEAD
+      Serial.println(String("usb poll period/phase/slack: ") + usb_sync_period + "/" + usb_sync_phase + "/" + usb_sync_slack);
+    #endif
+  #endif
+  usb_time = micros();
+}
+#endif
+
+// Raw button state, debounced and sent by whCommit()
 void whButton(uint8_t button, bool val) {
-  val = btDebncer[button].get(val);
+  if (val) wh_raw[button >> 5] |= 1UL << (button & 31);
+  else wh_raw[button >> 5] &= ~(1UL << (button & 31));
+}
+
+// Debounce every button at once and output the ones that changed
+// (USB: a word at a time, then the whole report at once)
+void whCommit() {
+  btDebncer.update(wh_raw);
+  const uint32_t* val = btDebncer.value();
+  for (uint8_t w=0; w<VD_WORDS; w++) {
+    uint32_t diff = val[w] ^ wh_out[w];
+    if (!diff) continue;
+    wh_out[w] = val[w];
+    #ifdef IS_USB
+      // bit n is button n, report bit n-1
+      if (w) Joystick.setButtons(wh_report, w * 32 - 1, diff, val[w]);
+      else Joystick.setButtons(wh_report, 0, diff >> 1, val[w] >> 1);
+    #else
+      while (diff) {
+        uint8_t bit = __builtin_ctz(diff);
+        diff &= diff - 1;
+        whOutput(w * 32 + bit, (val[w] >> bit) & 1);
+      }
+    #endif
+  }
   #ifdef IS_USB
-    Joystick.button(button, val);
-  #else
+    Joystick.setReport(wh_report);
+  #endif
+}
+
+#ifdef HAS_DEBUG
+// One frame worth of debouncing (89 buttons), in CPU cycles
+void debounceBenchmark() {
+  Debouncer* deb = new Debouncer[89];
+  VerticalDebouncer vdeb;
+  uint32_t raw[VD_WORDS];
+  uint32_t t, deb_cycles = 0, vdeb_cycles = 0;
+  volatile uint8_t sink = 0;
+
+  cyclesBegin();
+  for (int n=0; n<100; n++) {
+    raw[0] = random(0x7FFFFFFF) << 1;
+    raw[1] = random(0x7FFFFFFF) << 1;
+    raw[2] = random(0x3FFFFFF);
+
+    t = cyclesNow();
+    for (uint8_t b=0; b<89; b++) sink = deb[b].get((raw[b >> 5] >> (b & 31)) & 1);
+    deb_cycles += cyclesSince(t);
+
+    t = cyclesNow();
+    vdeb.update(raw);
+    vdeb_cycles += cyclesSince(t);
+  }
+  (void)sink;
+  delete[] deb;
+  Serial.println(String("debounce cycles per frame, Debouncer: ") + deb_cycles / 100
+    + ", VerticalDebouncer: " + vdeb_cycles / 100);
+}
+#endif
+
+#ifndef IS_USB
+// One button into the BT report (USB: whCommit() sets whole words)
+void whOutput(uint8_t button, bool val) {
     uint8_t old;
     if (--button >= 48) return;
       if (button >= 40) {
@@ -719,15 +682,15 @@ void whButton(uint8_t button, bool val) {
           #endif
         }
     }
-  #endif
 }
+#endif
 
 void whStick(unsigned int x, unsigned int y) {
   x = 255 - (x + 127);
   y = y + 127;
   #ifdef IS_USB
-    Joystick.X(x);
-    Joystick.Y(y);
+    wh_report.x = x;
+    wh_report.y = y;
   #else
   uint8_t old = hid_data[9];
   hid_data[9] = x & 0xFF;
@@ -750,8 +713,8 @@ void whStick(unsigned int x, unsigned int y) {
 
 void whDoubleAxis(unsigned int x, unsigned int y) {
   #ifdef IS_USB
-    Joystick.clutch1(x);
-    Joystick.clutch2(y);
+    wh_report.clutch1 = x;
+    wh_report.clutch2 = y;
   #else
   uint8_t old = hid_data[9];
   hid_data[9] = x & 0xFF;
@@ -776,8 +739,8 @@ void whDoubleClutch(unsigned int x, unsigned int y) {
   if(y > x) x = y;
 
   #ifdef IS_USB
-    Joystick.clutch1(x);
-    Joystick.clutch2(0);
+    wh_report.clutch1 = x;
+    wh_report.clutch2 = 0;
   #else
     uint8_t old = hid_data[9];
     hid_data[9] = x & 0xFF;
@@ -791,7 +754,9 @@ void whDoubleClutch(unsigned int x, unsigned int y) {
 }
 
 void whHat(int8_t val, bool is_csl) {
+  int8_t raw = val;
   val = hatDebncer.get(val);
+  if (val != raw) wh_pending = true;
   if (is_csl) { // CSL
     switch (val){
       case 4: val=0;break;
@@ -810,7 +775,7 @@ void whHat(int8_t val, bool is_csl) {
     }
   }
   #ifdef IS_USB
-    Joystick.hat(val);
+    wh_report.hat = val;
   #else
     uint8_t old = hid_data[11];
     hid_data[11] = val & 0xFF;
@@ -826,14 +791,46 @@ void whHat(int8_t val, bool is_csl) {
 void whSetId(unsigned int val) {
   csw_out.id = val & 0xFF;
   #ifdef IS_USB
-    Joystick.setWheel(val);
+    wh_report.wheel = val;
+  #else
+    uint8_t old = hid_data[HID_TAIL];
+    hid_data[HID_TAIL] = csw_out.id;
+    if (old != hid_data[HID_TAIL]){
+      in_changed = true;
+      #ifdef HAS_DEBUG
+        Serial.println(String("whSetId: new input! ") + old + " -> " + hid_data[HID_TAIL]);
+      #endif
+    }
+  #endif
+}
+
+// GT3 switch positions (raw garbage[3]), for host software
+void whSwitch(uint8_t val) {
+  #ifdef IS_USB
+    wh_report.switches = val;
   #else
-    uint8_t old = hid_data[32];
-    hid_data[32] = csw_out.id;
-    if (old != hid_data[32]){
+    uint8_t old = hid_data[HID_TAIL+1];
+    hid_data[HID_TAIL+1] = val;
+    if (old != hid_data[HID_TAIL+1]){
       in_changed = true;
       #ifdef HAS_DEBUG
-        Serial.println(String("whSetId: new input! ") + old + " -> " + hid_data[32]);
+        Serial.println(String("whSwitch: new input! ") + old + " -> " + hid_data[HID_TAIL+1]);
+      #endif
+    }
+  #endif
+}
+
+// Rotary encoder detents since the last report (relative axis)
+void whEncoder(int8_t val) {
+  #ifdef IS_USB
+    wh_report.encoder = val;
+  #else
+    uint8_t old = hid_data[HID_TAIL+2];
+    hid_data[HID_TAIL+2] = val;
+    if (old != hid_data[HID_TAIL+2]){
+      in_changed = true;
+      #ifdef HAS_DEBUG
+        Serial.println(String("whEncoder: new input! ") + old + " -> " + hid_data[HID_TAIL+2]);
       #endif
     }
   #endif
@@ -841,13 +838,13 @@ void whSetId(unsigned int val) {
 
 void whClear(){
   whSetId(NO_RIM);
+  whSwitch(0);
   whStick(0, 0);
   whHat(0, false);
   whDoubleAxis(0x00, 0x00);
-  for (int i = 1; i <= 37; ++i)
-  {
-    whButton(i, 0);
-  }
+  memset(wh_raw, 0, sizeof(wh_raw));
+  memset(gt3_active, 0, sizeof(gt3_active));
+  rotary.clear();
   clutch_max = 0xFF;
   show_fwvers = true;
   disp_timout = 0;
@@ -871,60 +868,109 @@ int iwrap_out(int len, unsigned char *data) {
   return nbytes;
 }
 
-void hid_output(uint8_t link_id, uint16_t data_length, const uint8_t *data) {
-  if(data[2] == 0x01 && data[3] == 0x02){
-      // 7 seg
+// 7 seg display, 3 digits in CSW segment format
+static void hidDisplay(const uint8_t *disp) {
     if(!show_fwvers){
-      if (detectWheelType() == MCL_WHEEL) {
+      if (currentWheelType() == MCL_WHEEL) {
         mcl_out.raw[1] = 0x11;
-        mcl_out.raw[2] = csw7segToAscii(data[4] & 0xff);
-        mcl_out.raw[3] = csw7segToAscii(data[5] & 0xff);
-        mcl_out.raw[4] = csw7segToAscii(data[6] & 0xff);
+        mcl_out.raw[2] = csw7segToAscii(disp[0] & 0xff);
+        mcl_out.raw[3] = csw7segToAscii(disp[1] & 0xff);
+        mcl_out.raw[4] = csw7segToAscii(disp[2] & 0xff);
 
       #ifdef HAS_DEBUG
         Serial.print(String("HID display: " ));
-        Serial.print(data[4], HEX);
+        Serial.print(disp[0], HEX);
         Serial.print(":");
-        Serial.print(data[5], HEX);
+        Serial.print(disp[1], HEX);
         Serial.print(":");
-        Serial.print(data[6], HEX);
+        Serial.print(disp[2], HEX);
         Serial.println();
       #endif
       } else {
         if(csw_in.id == CSLMCLGT3){
           csw_out.raw[1] = 0x11;
-          csw_out.raw[2] = csw7segToAscii(data[4] & 0xff);
-          csw_out.raw[3] = csw7segToAscii(data[5] & 0xff);
-          csw_out.raw[4] = csw7segToAscii(data[6] & 0xff);
+          csw_out.raw[2] = csw7segToAscii(disp[0] & 0xff);
+          csw_out.raw[3] = csw7segToAscii(disp[1] & 0xff);
+          csw_out.raw[4] = csw7segToAscii(disp[2] & 0xff);
         } else {
-          csw_out.disp[0] = (data[4] & 0xff);
-          csw_out.disp[1] = (data[5] & 0xff);
-          csw_out.disp[2] = (data[6] & 0xff);
+          csw_out.disp[0] = (disp[0] & 0xff);
+          csw_out.disp[1] = (disp[1] & 0xff);
+          csw_out.disp[2] = (disp[2] & 0xff);
         }
       #ifdef HAS_DEBUG
         Serial.println(String("HID display: " )+ csw_out.disp[0]+":"+csw_out.disp[1]+":"+csw_out.disp[2]);
       #endif
       }
     }
-  } else if(data[2] == 0x01 && data[3] == 0x03){
-      // rumbles
+}
+
+static void hidRumbles(uint8_t left, uint8_t right) {
     if (csw_out.id != UNIHUB && csw_in.id != CSLMCLGT3){
-      csw_out.rumble[0] = (data[4] & 0xff);
-      csw_out.rumble[1] = (data[5] & 0xff);
+      csw_out.rumble[0] = left;
+      csw_out.rumble[1] = right;
     }
       #ifdef HAS_DEBUG
         Serial.println(String("HID rumbles: " )+ csw_out.rumble[0]+":"+csw_out.rumble[1]);
       #endif
-  } else if(data[2] == 0x08){
-      // Rev Lights
+}
+
+static void hidLeds(uint16_t leds) {
     if (csw_out.id != UNIHUB && csw_in.id != CSLMCLGT3){
-      csw_out.leds = (data[3] & 0xff) << 8 | (data[4] & 0xff);
+      csw_out.leds = leds;
       // ftx_pck[5] = (hid_pck[4] & 0xff);
       // ftx_pck[6] = (hid_pck[3] & 0xff);
     }
       #ifdef HAS_DEBUG
         Serial.println(String("HID leds   : " )+ csw_out.leds);
       #endif
+}
+
+/*
+  HID output packet. Legacy (Fanaleds) packets set one output each,
+  with the command in data[2]. A host that sends command 0xF2 with
+  data[3] = 1 (0 to go back) gets unified packets, which set them all at
+  once; legacy packets keep working:
+    data[0..1] rumbles, left and right
+    data[2]    0xE0 | rev light 9 (bit 0)
+    data[3]    rev lights 1-8
+    data[4..6] 7 seg display
+*/
+void hid_output(uint8_t link_id, uint16_t data_length, const uint8_t *data) {
+  if(HID_IS_UNIFIED(data)){
+      // all outputs
+    hidLeds((data[2] & 0x01) << 8 | (data[3] & 0xff));
+    hidRumbles(data[0], data[1]);
+    hidDisplay(data + 4);
+  } else if(data[2] == 0x01 && data[3] == 0x02){
+      // 7 seg
+    hidDisplay(data + 4);
+  } else if(data[2] == 0x01 && data[3] == 0x03){
+      // rumbles
+    hidRumbles(data[4], data[5]);
+  } else if(data[2] == 0x08){
+      // Rev Lights
+    hidLeds((data[3] & 0xff) << 8 | (data[4] & 0xff));
+  } else if(data[2] == 0xF2){
+      // Output format: unified packets on/off
+    hid_unified = data[3] == 0x01;
+      #ifdef HAS_DEBUG
+        Serial.println(String("HID unified: ") + hid_unified);
+      #endif
+  } else if(data[2] == 0xF1){
+      // Button remap: table, HID button from, HID button to
+    uint8_t n = mapRemap(mapTable(data[3]), data[4], data[5]);
+    if (n) {
+      // release the old button, then have every table decoded again in
+      // case another one (or a GT3 switch) writes it too
+      mapRelease(mapTable(data[3]), wh_raw);
+      memset(gt3_active, 0, sizeof(gt3_active));
+      wh_pending = true;
+    }
+      #ifdef HAS_DEBUG
+        Serial.println(String("HID remap  : ") + data[3] + ":" + data[4] + " -> " + data[5] + " (" + n + ")");
+      #else
+        (void)n;
+      #endif
   } else if(data[1] == 0x14){
       // ??
 
@@ -946,12 +992,224 @@ void hid_output(uint8_t link_id, uint16_t data_length, const uint8_t *data) {
 }
 
 
+/*
+  Word mask (bit n: bytes 4n to 4n+3) of the frame bytes 0-31 that
+  changed since the last call. Everything counts as changed for the
+  first frame of a rim, or while the hat debouncer holds back a change,
+  so it keeps being polled until it settles. Buttons keep their raw
+  state between frames and are debounced by whCommit() every loop.
+  raw must be word aligned.
+*/
+uint8_t frameChanged(const uint8_t* raw) {
+  const uint32_t* words = (const uint32_t*)raw;
+  uint8_t changed = 0;
+
+  if (frame_session != rim_session) {
+    frame_session = rim_session;
+    changed = FRAME_ALL;
+  }
+  for (uint8_t i=0; i<8; i++) {
+    if (words[i] != last_frame[i]) {
+      last_frame[i] = words[i];
+      changed |= 1 << i;
+    }
+  }
+  if (wh_pending) changed = FRAME_ALL;
+  wh_pending = false;
+  return changed;
+}
+
+/*
+  Decode kernels, one per rim protocol (and GT3 clutch mode), picked by
+  rimDecoder() when the rim type, ID or clutch mode changes instead of
+  checking them on every frame. The table is a template argument, but the buttons still go through the
+  runtime tables (mapDecode()), since they can be remapped by the host.
+  MCL frames share the CSW layout.
+*/
+
+// CSW rims, HUB: hub buttons table (MAP_TABLES for none)
+template<uint8_t HUB>
+void decodeCsw(const uint8_t* raw, uint8_t changed) {
+  const csw_in_t* in = (const csw_in_t*)raw;
+
+  if (HUB != MAP_TABLES && (changed & FRAME_HUB))
+    mapDecode(mapTable(HUB), raw, wh_raw);
+  if (!(changed & FRAME_CORE)) return;
+
+  // Wheel ID
+  whSetId(in->id);
+
+  // Left stick
+  whStick(in->axisX, in->axisY);
+
+  // All buttons
+  mapDecode(mapTable(MAP_CSW), raw, wh_raw);
+
+  rotary_value = in->encoder;
+  rotary.add(rotary_value);
+
+  whHat(in->buttons[0] & 0x0f, false);
+}
+
+// McLaren GT3, on a CSW (MAP_GT3) or a CSL (MAP_MCL) base,
+// CLUTCH: clutch paddle mode
+template<uint8_t TABLE, uint8_t CLUTCH>
+void decodeGt3(const uint8_t* raw, uint8_t changed) {
+  const csw_in_t* in = (const csw_in_t*)raw;
+
+  if (!(changed & FRAME_CORE)) return;
+
+  // Wheel ID
+  whSetId(in->id);
+
+  whHat(in->buttons[0] & 0x0f, false);
+
+  // All buttons
+  mapDecode(mapTable(TABLE), raw, wh_raw);
+  decodeGt3Switches(in);
+
+  rotary_value = in->encoder;
+
+  if (CLUTCH == CLUTCH_ADVANCED && !in->axisX) // left clutch fully pressed
+  {
+    clutch_max = constrain(clutch_max + rotary_value, 0, 0xFF);
+  } else {
+    rotary.add(rotary_value);
+  }
+
+  // clutch paddle
+  if (CLUTCH == CLUTCH_BITE) {
+    whDoubleClutch(~in->axisX, ~in->axisY);
+  } else if (CLUTCH == CLUTCH_ADVANCED) {
+    whDoubleClutch(map(~in->axisX & 0xFF,0,0xFF,0,clutch_max) , ~in->axisY&0xff);
+  } else {
+    whDoubleAxis(~in->axisX, ~in->axisY);
+  }
+
+  whStick(0, 0);
+}
+
+/*
+  GT3 multi-position switches. garbage[3] holds the switch position
+  (high nibble, 1 to 12) and the rotary position (low nibble, 1 to 12).
+  The switch position picks the 4 buttons driven by the 2 switches,
+  the rotary position a single button (ignored while the display
+  button is held). At most 5 of these 60 buttons are pressed, so only
+  the ones that changed since the last frame are written.
+*/
+void decodeGt3Switches(const csw_in_t* in) {
+  static const uint8_t first[4] = {8, 19, 10, 20}; // position 1
+  uint8_t pos = in->garbage[3] >> 4;
+  uint8_t rot = in->garbage[3] & 0x0F;
+  // left up, left down, right up, right down
+  bool dirs[4] = {
+    (in->buttons[1] & 0x10) != 0, (in->buttons[2] & 0x80) != 0,
+    (in->buttons[1] & 0x02) != 0, (in->buttons[2] & 0x40) != 0
+  };
+  uint8_t active[5] = {0};
+
+  if (pos >= 1 && pos <= 12) {
+    for (uint8_t k=0; k<4; k++) {
+      if (dirs[k]) active[k] = pos == 1 ? first[k] : 33 + 4 * (pos - 2) + k;
+    }
+  }
+  if (rot >= 1 && rot <= 12 && !(in->buttons[2] & 0x20)) active[4] = 20 + rot;
+
+  for (uint8_t k=0; k<5; k++) {
+    if (active[k] == gt3_active[k]) continue;
+    if (gt3_active[k]) whButton(gt3_active[k], 0);
+    if (active[k]) whButton(active[k], 1);
+    gt3_active[k] = active[k];
+  }
+
+  whSwitch(in->garbage[3]);
+}
+
+// Pick the decode kernel, only when the rim type, ID or clutch mode changes
+void rimDecoder(wheel_type type, const uint8_t* raw) {
+  static const rim_decoder_t gt3_kernels[2][3] = {
+    {decodeGt3<MAP_MCL, CLUTCH_AXES>, decodeGt3<MAP_MCL, CLUTCH_BITE>,
+      decodeGt3<MAP_MCL, CLUTCH_ADVANCED>},
+    {decodeGt3<MAP_GT3, CLUTCH_AXES>, decodeGt3<MAP_GT3, CLUTCH_BITE>,
+      decodeGt3<MAP_GT3, CLUTCH_ADVANCED>}
+  };
+  const csw_in_t* in = (const csw_in_t*)raw;
+  uint8_t id = in->id;
+  bool gt3 = type == MCL_WHEEL || id == CSLMCLGT3;
+  uint8_t clutch = gt3 ? in->garbage[2] & 0x0F : CLUTCH_AXES;
+  if (clutch > CLUTCH_ADVANCED) clutch = CLUTCH_AXES;
+
+  if (type == decoder_type && id == decoder_id && clutch == decoder_clutch) return;
+  decoder_type = type;
+  decoder_id = id;
+  decoder_clutch = clutch;
+
+  if (gt3) rim_decode = gt3_kernels[type != MCL_WHEEL][clutch];
+  else if (id == UNIHUB) rim_decode = decodeCsw<MAP_UNIHUB>;
+  else if (id == XBOXHUB) rim_decode = decodeCsw<MAP_XBOXHUB>;
+  else rim_decode = decodeCsw<MAP_TABLES>;
+}
+
+// CSL clusters, in scan order
+const uint8_t csl_selectors[5] = {0x00, 0x41, 0x02, 0x44, 0x08};
+uint8_t csl_next = 0;
+
+// Send the next CSL selector and decode the reply to the previous one
+// Returns the selector decoded (CSL_NONE if there was none)
+uint8_t cslStep() {
+  uint8_t selector = csl_selectors[csl_next];
+  csl_next = (csl_next + 1) % sizeof(csl_selectors);
+
+  switch (selector) {
+    case 0x41: csl_out.disp = csw7segToCsl(csw_out.disp[0]); break; // 1st disp
+    case 0x02: csl_out.disp = csw7segToCsl(csw_out.disp[1]); break; // 2nd disp
+    case 0x44: csl_out.disp = csw7segToCsl(csw_out.disp[2]); break; // 3rd disp
+    case 0x08: csl_out.disp = cswLedsToCsl(csw_out.leds); break;    // RGB Led
+  }
+  uint8_t replied = transferCslNext(&csl_out, &csl_in, sizeof(csl_out.raw), selector);
+  cslDecode(replied);
+  return replied;
+}
+
+void cslDecode(uint8_t selector) {
+  switch (selector) {
+    case 0x41:
+      // Joystick
+      whHat(csl_in.buttons & 0x1E, true);
+      whButton(13, csl_in.buttons & 0x01); // hat button
+      break;
+    case 0x02:
+      // Right Line
+      whButton(11, csl_in.buttons & 0x01); // wrench
+      whButton(5, csl_in.buttons & 0x04); // RT
+      whButton(14, csl_in.buttons & 0x08); // xbox
+      whButton(6, csl_in.buttons & 0x10); // RSB
+      break;
+    case 0x44:
+      // Left cluster
+      whButton(15, csl_in.buttons & 0x01); // left paddle
+      whButton(9, csl_in.buttons & 0x02); // lines
+      whButton(10, csl_in.buttons & 0x04); // squares
+      whButton(8, csl_in.buttons & 0x08); // LSB
+      whButton(7, csl_in.buttons & 0x10); // LT
+      break;
+    case 0x08:
+      // Right cluster
+      whButton(16, csl_in.buttons & 0x01); // right paddle
+      whButton(1, csl_in.buttons & 0x02); // B
+      whButton(2, csl_in.buttons & 0x04); // A
+      whButton(3, csl_in.buttons & 0x08); // Y
+      whButton(4, csl_in.buttons & 0x10); // X
+      break;
+  }
+}
+
 void init_wheel() {
   if(show_fwvers){
 
     if (disp_timout == 0){
       // start showing fw vers
-      if (detectWheelType() == MCL_WHEEL) {
+      if (currentWheelType() == MCL_WHEEL) {
         String fw_vers = String(mcl_in.fwvers);
         mcl_out.raw[1] = 0x11;
         // Erase all
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2015 darknao
+ * https://github.com/darknao/btClubSportWheel
+ *
+ * This file is part of btClubSportWheel.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _CYCLES_H_
+#define _CYCLES_H_
+
+#include <kinetis.h>
+
+/*
+  CPU cycle counter for benchmarks.
+  Teensy 3.x uses the DWT cycle counter. The Cortex-M0+ of the LC has
+  none, so SysTick (counting down, reloaded every ms) is used instead:
+  keep the measured code well under a millisecond.
+*/
+static inline void cyclesBegin() {
+#if defined(KINETISK)
+  ARM_DEMCR |= ARM_DEMCR_TRCENA;
+  ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
+#endif
+}
+
+static inline uint32_t cyclesNow() {
+#if defined(KINETISK)
+  return ARM_DWT_CYCCNT;
+#else
+  return SYST_CVR;
+#endif
+}
+
+static inline uint32_t cyclesSince(uint32_t start) {
+#if defined(KINETISK)
+  return ARM_DWT_CYCCNT - start;
+#else
+  uint32_t now = SYST_CVR;
+  if (now <= start) return start - now;
+  return start + SYST_RVR + 1 - now;
+#endif
+}
+
+#endif
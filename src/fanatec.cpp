@@ -19,17 +19,43 @@
  */
 
 #include "fanatec.h"
+#ifdef RIM_SPI_DMA
+#include <DMAChannel.h>
+#endif
+#ifdef RIM_SPI_FIFO
+#include <SPIFIFO.h>
+#endif
+#ifdef HAS_DEBUG
+#include "cycles.h"
+#endif
 
 // SPI setting to communicate with Fanatec PCB.
 // Basically default setting, except speed is set to 12Mhz
+// (changed at runtime by rimSetTiming())
 SPISettings settingsA(12000000, MSBFIRST, SPI_MODE0);
-SPISettings settingsB(12000000, MSBFIRST, SPI_MODE1);
+
+// SPI clocks for rimSetTiming(), fastest first
+const uint32_t rim_clocks[RIM_CLOCKS] = {
+  24000000, 16000000, 12000000, 8000000, 6000000, 4000000
+};
 
 // Conversion table for CSW 7segs to CSL
 uint8_t csw2csl_disp[8] = {6, 4, 0, 2, 5, 7, 1, 3};
 
-wheel_type rim_inserted = NO_WHEEL;
+volatile wheel_type rim_inserted = NO_WHEEL;
 unsigned int CS_WAIT = 5;
+// CS setup time for CSW/MCL frames, in µs
+unsigned int rim_cs_setup = 0;
+
+// Last measured rim frame time (CS low to CS high), in µs
+#if defined(RIM_SPI_DMA)
+const char* rim_spi_backend = "DMA";
+#elif defined(RIM_SPI_FIFO)
+const char* rim_spi_backend = "FIFO";
+#else
+const char* rim_spi_backend = "SPI";
+#endif
+volatile uint32_t rim_frame_us = 0;
 
 // CRC lookup table with polynomial of 0x131
 PROGMEM prog_uchar _crc8_table[256] = {
@@ -67,7 +93,356 @@ PROGMEM prog_uchar _crc8_table[256] = {
   182, 232, 10, 84, 215, 137, 107, 53
 };
 
+// Per-session frame counters, reset on rim detection
+volatile rim_stats_t rim_stats;
+
+/*
+  A frame with a bad CRC is only dropped: the rim is considered gone
+  after RIM_LOST_FRAMES of them in a row, or when a frame with a good CRC
+  has the wrong header.
+*/
+#define RIM_LOST_FRAMES 8
+static uint8_t rim_bad_run = 0;
+
+#ifdef RIM_SPI_FIFO
+// CSW frames currently clocked with the extra bit (see transferCswData)
+static bool csw_bit_slip = false;
+#endif
 
+static void rimBadFrame() {
+  rim_stats.bad++;
+  if (++rim_bad_run >= RIM_LOST_FRAMES) {
+    rim_bad_run = 0;
+    rim_inserted = NO_WHEEL;
+  }
+}
+
+// Feed one byte to a running CRC8
+static inline uint8_t crc8_update(uint8_t crc, uint8_t data) {
+  return pgm_read_byte_near(_crc8_table + (data ^ crc));
+}
+
+
+#ifdef RIM_SPI_DMA
+/*
+  DMA frame engine.
+  A full duplex frame is clocked in the background by two DMA channels
+  (TX feeds the SPI data register, RX drains it), while loop() decodes the
+  previous one. dma_in is the back buffer, the caller's *in is the front.
+*/
+DMAChannel dma_tx;
+DMAChannel dma_rx;
+volatile bool dma_busy = false;
+bool dma_pending = false;
+uint32_t dma_start_us;
+uint8_t dma_out[33];
+uint8_t dma_in[33];
+
+// RX channel completion: the last byte is in, release the rim
+void dmaFrameDone() {
+  dma_rx.clearInterrupt();
+  digitalWriteFast(CS, HIGH);
+#if defined(KINETISK)
+  SPI0_RSER = 0;
+  SPI0_SR = 0xFF0F0000;
+#else
+  SPI0_C2 = 0;
+#endif
+  SPI.endTransaction();
+  rim_frame_us = micros() - dma_start_us;
+  dma_busy = false;
+}
+
+// Start a frame and return right away
+void rimFrameStart(const uint8_t* out, uint8_t length) {
+#ifdef CRC8_HW
+  memcpy(dma_out, out, length-1);
+  dma_out[length-1] = crc8(out, length-1);
+#else
+  // copy the frame and append its CRC in the same pass
+  uint8_t crc = 0xff;
+  for (uint8_t i=0; i<length-1; i++) {
+    dma_out[i] = out[i];
+    crc = crc8_update(crc, out[i]);
+  }
+  dma_out[length-1] = crc;
+#endif
+  dma_busy = true;
+  dma_pending = true;
+
+  SPI.beginTransaction(settingsA);
+  digitalWriteFast(CS, LOW);
+  if (rim_cs_setup) delayMicroseconds(rim_cs_setup);
+  dma_start_us = micros();
+#if defined(KINETISK)
+  SPI0_MCR |= SPI_MCR_CLR_TXF | SPI_MCR_CLR_RXF;
+  SPI0_SR = 0xFF0F0000;
+  dma_tx.sourceBuffer(dma_out, length);
+  dma_tx.destination(*(volatile uint8_t *)&SPI0_PUSHR);
+  dma_rx.source(*(volatile uint8_t *)&SPI0_POPR);
+  dma_rx.destinationBuffer(dma_in, length);
+#else
+  (void)SPI0_S;
+  (void)SPI0_DL;
+  dma_tx.sourceBuffer(dma_out, length);
+  dma_tx.destination(SPI0_DL);
+  dma_rx.source(SPI0_DL);
+  dma_rx.destinationBuffer(dma_in, length);
+#endif
+  dma_rx.enable();
+  dma_tx.enable();
+#if defined(KINETISK)
+  SPI0_RSER = SPI_RSER_TFFF_RE | SPI_RSER_TFFF_DIRS | SPI_RSER_RFDF_RE | SPI_RSER_RFDF_DIRS;
+#else
+  SPI0_C2 = SPI_C2_TXDMAE | SPI_C2_RXDMAE;
+#endif
+}
+
+// true once the frame in flight (if any) has been fully clocked:
+// rimTransfer() then returns without waiting
+bool rimFrameReady() {
+  return !dma_busy;
+}
+
+// Wait for any frame in flight, so SPIClass can be used directly again
+void rimFrameFlush() {
+  while (dma_busy) ;
+  dma_pending = false;
+}
+#endif
+
+#ifdef RIM_SPI_FIFO
+/*
+  DSPI FIFO burst backend (Teensy 3.x only).
+  CS is driven by the DSPI as PCS0 and the setup/hold delays live in the
+  CTARs, so there is no digitalWrite/delayMicroseconds around the frame.
+  CTAR0 is used for CSW/MCL frames, CTAR1 for CSL frames (CS_WAIT setup)
+  or for the 9 bit first frame of a CSW frame with a bit slip.
+*/
+uint32_t fifo_ctar0;
+uint32_t fifo_ctar1;
+uint32_t fifo_ctar9;
+
+// Smallest CTAR delay (prescaler p, scaler n) lasting at least us µs:
+// delay = {1,3,5,7}[p] * 2^(n+1) / F_BUS
+static uint32_t fifoDelay(uint32_t us, uint8_t p_shift, uint8_t n_shift) {
+  static const uint8_t prescaler[4] = {1, 3, 5, 7};
+  uint32_t cycles = (F_BUS / 1000000) * us;
+  uint32_t best = 0xFFFFFFFF;
+  uint32_t p = 3, n = 15;
+  for (uint32_t i=0; i<4; i++) {
+    for (uint32_t j=0; j<16; j++) {
+      uint32_t d = prescaler[i] << (j + 1);
+      if (d >= cycles && d < best) {
+        best = d;
+        p = i;
+        n = j;
+      }
+    }
+  }
+  return (p << p_shift) | (n << n_shift);
+}
+#define FIFO_CSSCK(us)  fifoDelay(us, 22, 12)  // PCS to SCK (setup)
+#define FIFO_ASC(us)    fifoDelay(us, 20, 8)   // SCK to PCS (hold)
+#define FIFO_DT(us)     fifoDelay(us, 18, 4)   // PCS idle between frames
+
+// CTAR clock bits matching rim_clocks
+const uint32_t fifo_clocks[RIM_CLOCKS] = {
+  SPI_CLOCK_24MHz, SPI_CLOCK_16MHz, SPI_CLOCK_12MHz,
+  SPI_CLOCK_8MHz, SPI_CLOCK_6MHz, SPI_CLOCK_4MHz
+};
+
+// clock: CTAR clock and mode bits
+static void fifoTiming(uint32_t clock) {
+  fifo_ctar0 = clock | SPI_CTAR_FMSZ(7)
+    | FIFO_CSSCK(rim_cs_setup) | FIFO_ASC(0) | FIFO_DT(0);
+  fifo_ctar1 = clock | SPI_CTAR_FMSZ(7)
+    | FIFO_CSSCK(CS_WAIT) | FIFO_ASC(0) | FIFO_DT(CS_WAIT);
+  fifo_ctar9 = (fifo_ctar0 & ~SPI_CTAR_FMSZ(15)) | SPI_CTAR_FMSZ(8);
+}
+
+void fifoSetup() {
+  // pin 10 (PTC4) as PCS0, SCK/MOSI/MISO muxed to SPI0
+  SPIFIFO.begin(CS, SPI_CLOCK_12MHz);
+  fifoTiming(SPI_CLOCK_12MHz);
+}
+
+// Hand CS over to the DSPI and (re)load our CTARs,
+// SPI.beginTransaction() may have overwritten them
+static void fifoAcquire(uint32_t ctar1) {
+  if (SPI0_CTAR0 != fifo_ctar0 || SPI0_CTAR1 != ctar1) {
+    SPI0_MCR = SPI_MCR_MSTR | SPI_MCR_MDIS | SPI_MCR_HALT | SPI_MCR_PCSIS(0x1F);
+    SPI0_CTAR0 = fifo_ctar0;
+    SPI0_CTAR1 = ctar1;
+    SPI0_MCR = SPI_MCR_MSTR | SPI_MCR_PCSIS(0x1F);
+  }
+  CORE_PIN10_CONFIG = PORT_PCR_MUX(2);
+}
+
+// Give CS back to GPIO for the SPIClass transfers (rim detection)
+void fifoRelease() {
+  digitalWriteFast(CS, HIGH);
+  pinMode(CS, OUTPUT);
+}
+
+// Burst a frame through the 4-deep TX/RX FIFOs
+// With crc set, the last byte sent is the CRC of the others.
+// Returns the CRC of the received bytes, last one excluded.
+/*
+  With slip set, the rim answers one bit late: the frame is clocked with
+  one extra bit, the first word being 9 bits wide. The late bit ends up
+  in bit 8 of the first word and every received byte is aligned, while
+  the bits sent are the same, only regrouped (plus a trailing 0).
+*/
+static uint8_t fifoTransfer(uint8_t* out, uint8_t* in, uint8_t length, uint8_t ctas, bool crc, bool slip) {
+  uint8_t last = length - 1;
+  uint8_t tx = 0, rx = 0;
+  uint8_t crc_out = 0xff, crc_in = 0xff;
+
+  fifoAcquire(slip ? fifo_ctar9 : fifo_ctar1);
+  SPI0_MCR = SPI_MCR_MSTR | SPI_MCR_PCSIS(0x1F) | SPI_MCR_CLR_TXF | SPI_MCR_CLR_RXF;
+  SPI0_SR = 0xFF0F0000;
+  while (rx < length) {
+    // keep the TX FIFO full, but never get more than 4 bytes ahead of RX
+    while (tx < length && (uint8_t)(tx - rx) < 4 && ((SPI0_SR >> 12) & 15) < 4) {
+      // last byte without CONT: PCS goes high after it
+      uint32_t cmd = SPI_PUSHR_PCS(1) | SPI_PUSHR_CTAS(ctas);
+      if (tx < last) {
+        cmd |= SPI_PUSHR_CONT;
+        crc_out = crc8_update(crc_out, out[tx]);
+        if (crc && tx + 1 == last) out[last] = crc_out;
+      }
+      uint32_t data = out[tx];
+      if (slip) {
+        data = (data << 1) | (tx < last ? out[tx+1] >> 7 : 0);
+        if (tx == 0) cmd = (cmd & ~SPI_PUSHR_CTAS(7)) | SPI_PUSHR_CTAS(1);
+        else data &= 0xFF;
+      }
+      SPI0_PUSHR = cmd | data;
+      tx++;
+    }
+    if (SPI0_SR & (15 << 4)) {
+      in[rx] = SPI0_POPR;
+      if (rx < last) crc_in = crc8_update(crc_in, in[rx]);
+      rx++;
+    }
+  }
+  return crc_in;
+}
+#endif
+
+/*
+  Full duplex frame exchange with the rim.
+  The last byte of *out is replaced by the CRC of the others while the
+  frame is clocked, and the CRC of the received frame (last byte
+  excluded) is returned, so callers never walk the buffers again.
+  bit_slip (FIFO backend only) absorbs a late CSW answer in the SPI frame
+  size, see fifoTransfer().
+*/
+uint8_t rimTransfer(uint8_t* out, uint8_t* in, uint8_t length, bool bit_slip) {
+  uint8_t crc_in = 0xff;
+#ifndef RIM_SPI_FIFO
+  (void)bit_slip;
+#endif
+#ifdef RIM_SPI_DMA
+  // first frame after (re)start: nothing to hand out yet
+  if (!dma_pending) rimFrameStart(out, length);
+  // callers poll rimFrameReady() first, this only waits for one that didn't
+  while (dma_busy) ;
+#ifdef CRC8_HW
+  memcpy(in, dma_in, length);
+  crc_in = crc8(in, length-1);
+#else
+  for (uint8_t i=0; i<length-1; i++) {
+    in[i] = dma_in[i];
+    crc_in = crc8_update(crc_in, in[i]);
+  }
+  in[length-1] = dma_in[length-1];
+#endif
+  // clock the next frame while the caller decodes this one
+  rimFrameStart(out, length);
+  out[length-1] = dma_out[length-1];
+#elif defined(RIM_SPI_FIFO)
+  uint32_t t = micros();
+  crc_in = fifoTransfer(out, in, length, 0, true, bit_slip);
+  rim_frame_us = micros() - t;
+#else
+  uint32_t t = micros();
+  uint8_t crc_out = 0xff;
+  uint8_t last = length - 1;
+  SPI.beginTransaction(settingsA);
+  digitalWrite(CS, LOW);
+  if (rim_cs_setup) delayMicroseconds(rim_cs_setup);
+  for(int i=0; i<last; i++) {
+    in[i] = SPI.transfer(out[i]);
+    crc_out = crc8_update(crc_out, out[i]);
+    crc_in = crc8_update(crc_in, in[i]);
+  }
+  out[last] = crc_out;
+  in[last] = SPI.transfer(crc_out);
+  digitalWrite(CS, HIGH);
+  SPI.endTransaction();
+  rim_frame_us = micros() - t;
+#endif
+  return crc_in;
+}
+
+#ifdef CRC8_HW
+/*
+  The CRC module has no 8 bit mode, so it runs as a 16 bit CRC with the
+  polynomial in the upper byte (x^8 * (x^8 + x^5 + x^4 + 1)): the upper
+  byte of the result is then the CRC8 and the lower one stays 0.
+  The table CRC is the reflected one, so words are written with bits and
+  bytes transposed (memory order, LSB first) and the result is read back
+  with bits transposed.
+  There is a single module for loop() and the sampler interrupt, so a
+  computation runs with interrupts masked. crc8HwSetup() checks it
+  against the table once, crc8() falls back to the table if they differ.
+*/
+static bool crc8_hw = false;
+
+void crc8HwSetup() {
+  static const uint8_t check[9] = {0xa4, 0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xef};
+  uint8_t crc = 0xff;
+
+  SIM_SCGC6 |= SIM_SCGC6_CRC;
+  CRC_CTRL = 0;
+  CRC_GPOLY = 0x3100;
+  for (uint8_t i=0; i<sizeof(check); i++) crc = crc8_update(crc, check[i]);
+  crc8_hw = true;
+  crc8_hw = crc8(check, sizeof(check)) == crc;
+}
+
+// return CRC8 from buf
+uint8_t crc8(const uint8_t* buf, uint8_t length) {
+    uint8_t crc = 0xff;
+    uint32_t word, primask;
+
+    if (crc8_hw && length >= 4) {
+        __asm__ volatile("mrs %0, primask\n" : "=r" (primask)::);
+        __disable_irq();
+        CRC_CTRL = CRC_CTRL_WAS;
+        CRC_CRC = 0xff00;
+        CRC_CTRL = CRC_CTRL_TOT(2) | CRC_CTRL_TOTR(1);
+        while (length >= 4) {
+            memcpy(&word, buf, 4);
+            CRC_CRC = word;
+            buf += 4;
+            length -= 4;
+        }
+        crc = CRC_CRC >> 8;
+        if (!primask) __enable_irq();
+    }
+
+    // tail
+    while (length) {
+        crc = crc8_update(crc, *buf);
+        buf++;
+        length--;
+    }
+    return crc;
+}
+#else
 // return CRC8 from buf
 uint8_t crc8(const uint8_t* buf, uint8_t length) {
     uint8_t crc = 0xff;
@@ -78,136 +453,306 @@ uint8_t crc8(const uint8_t* buf, uint8_t length) {
     }
     return crc;
 }
+#endif
+
+#if defined(CRC8_HW) && defined(HAS_DEBUG)
+// Check the CRC module against the table on random frames of every length
+bool crc8SelfTest() {
+  uint8_t frame[33];
+  for (int n=0; n<64; n++) {
+    for (uint8_t i=0; i<sizeof(frame); i++) frame[i] = random(256);
+    for (uint8_t len=0; len<=sizeof(frame); len++) {
+      uint8_t crc = 0xff;
+      for (uint8_t i=0; i<len; i++) crc = crc8_update(crc, frame[i]);
+      if (crc8(frame, len) != crc) {
+        Serial.println(String("crc8: hardware/table mismatch, length ") + len);
+        return false;
+      }
+    }
+  }
+  Serial.println("crc8: hardware CRC matches table");
+  return true;
+}
+#endif
+
+// Time from losing the rim (or boot) to the next detection, in µs
+uint32_t rim_resync_us = 0;
+// Incremented on every detection
+uint32_t rim_session = 0;
+
+// CSL selector sent last, which the next reply belongs to
+uint8_t csl_pending = CSL_NONE;
+
+// Detection state, see detectWheelType()
+enum detect_step {
+  DETECT_START,
+  DETECT_PROBE1,
+  DETECT_PROBE2,
+  DETECT_SETTLE
+};
+detect_step detect_state = DETECT_START;
+uint32_t detect_at;
+uint32_t detect_lost_at;
+uint8_t detect_byte;
+
+// SPI clock (index in rim_clocks), mode (0 or 1) and CS setup time (µs)
+// for the rim type. CSL rims use CS_WAIT, CSW/MCL rims rim_cs_setup.
+void rimSetTiming(wheel_type type, uint8_t clock, uint8_t mode, uint8_t cs_wait) {
+  #ifdef RIM_SPI_DMA
+  rimFrameFlush();
+  #endif
+  settingsA = SPISettings(rim_clocks[clock], MSBFIRST, mode ? SPI_MODE1 : SPI_MODE0);
+  if (type == CSL_WHEEL) {
+    CS_WAIT = cs_wait;
+  } else {
+    rim_cs_setup = cs_wait;
+  }
+  #ifdef RIM_SPI_FIFO
+  fifoTiming(fifo_clocks[clock] | (mode ? SPI_CTAR_CPHA : 0));
+  csw_bit_slip = false;
+  #endif
+  // errors with the previous timing don't count against this one
+  rim_bad_run = 0;
+}
+
+// Back to the settings used for detection
+void rimDefaultTiming() {
+  rimSetTiming(CSL_WHEEL, RIM_CLOCK_DEFAULT, 0, 5);
+  rimSetTiming(CSW_WHEEL, RIM_CLOCK_DEFAULT, 0, 0);
+}
 
 // Try to detect which wheel is connected by reading the header bit
 // transfer*Data also reset this state if the header bit is not the one expected
+/*
+  Detection never blocks: each call does at most one SPI transaction
+  and returns NO_WHEEL until the whole sequence is done.
+  The rim is probed twice (10µs apart, see transferCslData), then given
+  10ms to settle before its type is reported.
+*/
 wheel_type detectWheelType() {
-  if(rim_inserted == NO_WHEEL) {
-    switch(getFirstByte()) {
-      case 0x52:
-      case 0xD2: rim_inserted = CSW_WHEEL; break;
-      case 0xE0: rim_inserted = CSL_WHEEL; break;
-      case 0xA5: rim_inserted = MCL_WHEEL; break;
-      default: rim_inserted = NO_WHEEL; break;
-    }
+  if(rim_inserted != NO_WHEEL) return rim_inserted;
+  // detect_at is only meaningful while probing (it gets stale while a rim is in)
+  if (detect_state != DETECT_START && (int32_t)(micros() - detect_at) < 0) return NO_WHEEL;
+
+  switch (detect_state) {
+    case DETECT_START:
+      #ifdef RIM_SAMPLE_RATE
+      samplerStop();
+      #endif
+      detect_lost_at = micros();
+      rimDefaultTiming();
+      detect_state = DETECT_PROBE1;
+      // fall through
+    case DETECT_PROBE1:
+      getFirstByte();
+      detect_state = DETECT_PROBE2;
+      detect_at = micros() + 10;
+      break;
+    case DETECT_PROBE2:
+      detect_byte = getFirstByte();
+      detect_state = DETECT_SETTLE;
+      detect_at = micros() + 10000;
+      break;
+    case DETECT_SETTLE:
+      switch(detect_byte) {
+        case 0x52:
+        case 0xD2: rim_inserted = CSW_WHEEL; break;
+        case 0xE0: rim_inserted = CSL_WHEEL; break;
+        case 0xA5: rim_inserted = MCL_WHEEL; break;
+        default: rim_inserted = NO_WHEEL; break;
+      }
+      if (rim_inserted != NO_WHEEL) {
+        rim_stats.good = 0;
+        rim_stats.bad = 0;
+        rim_stats.realigned = 0;
+        rim_bad_run = 0;
+        rim_resync_us = micros() - detect_lost_at;
+        rim_session++;
+        csl_pending = CSL_NONE;
+        detect_state = DETECT_START;
+      } else {
+        // keep probing, but keep counting from the first try
+        detect_state = DETECT_PROBE1;
+      }
       #ifdef HAS_DEBUG
       Serial.println(String("Detected protocol: ") + rim_inserted);
+      if (rim_inserted != NO_WHEEL)
+        Serial.println(String("Resync time (us): ") + rim_resync_us);
       #endif
+      break;
   }
   return rim_inserted;
 }
 
+// Wheel type as last detected, without probing
+wheel_type currentWheelType() {
+  return rim_inserted;
+}
+
 // Fetch first byte from SPI transaction for protocol detection
+// (a single transaction, detectWheelType() does the sequencing)
 uint8_t getFirstByte() {
   uint8_t firstByte;
   uint8_t buf;
-  // Send packet, twice (see transferCslData)
-  for (int z=0; z<2; z++) {
-    SPI.beginTransaction(settingsA);
-    digitalWrite(CS, LOW);
-    delayMicroseconds(CS_WAIT);
-    firstByte = SPI.transfer(0x00);
-    /*
-      The CSW µC will resume any previously interrupted transaction.
-      firstByte will then not be the actual first byte, but something between.
-      This loop make sure we reach the end of a transaction before starting a new one
-      The CSL (P1) transaction size is only 1 byte, so it's not affected.
-    */
+  #ifdef RIM_SPI_DMA
+  rimFrameFlush();
+  #endif
+  #ifdef RIM_SPI_FIFO
+  fifoRelease();
+  #endif
+  SPI.beginTransaction(settingsA);
+  digitalWrite(CS, LOW);
+  delayMicroseconds(CS_WAIT);
+  firstByte = SPI.transfer(0x00);
+  /*
+    The CSW µC will resume any previously interrupted transaction.
+    firstByte will then not be the actual first byte, but something between.
+    This loop make sure we reach the end of a transaction before starting a new one
+    The CSL (P1) transaction size is only 1 byte, so it's not affected.
+  */
 
+  #ifdef HAS_DEBUG
+    Serial.print("Firstbyte: ");
+    Serial.println(firstByte, HEX);
+  #endif
+  if(firstByte  == 0x52){
     #ifdef HAS_DEBUG
-      Serial.print("Firstbyte: ");
-      Serial.println(firstByte, HEX);
+      Serial.println("csw: fast forward to next transaction");
     #endif
-    if(firstByte  == 0x52){
-      #ifdef HAS_DEBUG
-        Serial.println("csw: fast forward to next transaction");
-      #endif
-      for(int i=0; i<=31; i++) {
-        buf = SPI.transfer(0x00);
-        #ifdef HAS_DEBUG
-          Serial.print(buf, HEX);
-          Serial.print(":");
-        #endif
-      }
+    for(int i=0; i<=31; i++) {
+      buf = SPI.transfer(0x00);
       #ifdef HAS_DEBUG
-        Serial.println();
+        Serial.print(buf, HEX);
+        Serial.print(":");
       #endif
-    } else if(firstByte == 0xD2){
-      // 0x52 with extra byte from previous crc (wrong communication settings)
-      // so we need to flush this extra byte befor going forward
-      #ifdef HAS_DEBUG
-        Serial.println("csw: flushing buffer & fast forward to next transaction");
-      #endif
-      for(int i=0; i<=(31*2); i++) {
-        buf = SPI.transfer(0x00);
-        #ifdef HAS_DEBUG
-          Serial.print(buf, HEX);
-          Serial.print(":");
-        #endif
-      }
+    }
+    #ifdef HAS_DEBUG
+      Serial.println();
+    #endif
+  } else if(firstByte == 0xD2){
+    // 0x52 with extra byte from previous crc (wrong communication settings)
+    // so we need to flush this extra byte befor going forward
+    #ifdef HAS_DEBUG
+      Serial.println("csw: flushing buffer & fast forward to next transaction");
+    #endif
+    for(int i=0; i<=(31*2); i++) {
+      buf = SPI.transfer(0x00);
       #ifdef HAS_DEBUG
-        Serial.println();
+        Serial.print(buf, HEX);
+        Serial.print(":");
       #endif
+    }
+    #ifdef HAS_DEBUG
+      Serial.println();
+    #endif
 
-    } else if(firstByte != 0xE0 && firstByte != 0 ) {
-      // looks like we are in the middle of a transaction
+  } else if(firstByte != 0xE0 && firstByte != 0 ) {
+    // looks like we are in the middle of a transaction
+    #ifdef HAS_DEBUG
+    Serial.println("Realigning...");
+    #endif
+    uint8_t previousByte = 0;
+    uint8_t s;
+    for(int i=0; i<35; i++) {
+      s = SPI.transfer(0x00);
       #ifdef HAS_DEBUG
-      Serial.println("Realigning...");
+        Serial.print("searching: next byte: ");
+        Serial.println(s, HEX);
       #endif
-      uint8_t previousByte = 0;
-      uint8_t s;
-      for(int i=0; i<35; i++) {
-        s = SPI.transfer(0x00);
+      if( (previousByte == 0xA5 && s == 0x09) || (previousByte == 0x52 && s == 0x84) ){
+        // Here we go
+        firstByte = previousByte;
         #ifdef HAS_DEBUG
-          Serial.print("searching: next byte: ");
-          Serial.println(s, HEX);
+        Serial.println("mcl: Fast Forward to next transaction");
         #endif
-        if( (previousByte == 0xA5 && s == 0x09) || (previousByte == 0x52 && s == 0x84) ){
-          // Here we go
-          firstByte = previousByte;
+        for(int i=0; i<31; i++) {
+          buf = SPI.transfer(0x00);
           #ifdef HAS_DEBUG
-          Serial.println("mcl: Fast Forward to next transaction");
+            Serial.print(buf, HEX);
+            Serial.print(":");
           #endif
-          for(int i=0; i<31; i++) {
-            buf = SPI.transfer(0x00);
-            #ifdef HAS_DEBUG
-              Serial.print(buf, HEX);
-              Serial.print(":");
-            #endif
-          }
-          #ifdef HAS_DEBUG
-            Serial.println();
-          #endif
-          break;
-        } else {
-          previousByte = s;
         }
+        #ifdef HAS_DEBUG
+          Serial.println();
+        #endif
+        break;
+      } else {
+        previousByte = s;
       }
     }
-    digitalWrite(CS, HIGH);
-    SPI.endTransaction();
-
-    // wait for CS to settle a little
-    delayMicroseconds(10);
   }
-  delay(10);
+  digitalWrite(CS, HIGH);
+  SPI.endTransaction();
   return firstByte;
 }
 
-// CSW I/O
-void transferCswData(csw_out_t* out, csw_in_t* in, uint8_t length) {
-  // get CRC
-  out->crc = crc8(out->raw, length-1);
+/*
+  Shift a big endian bit stream left by one bit, 32 bits at a time.
+  Words are loaded little endian, so they are byte swapped (REV) around
+  the shift. The buffer must be padded with zeros up to a whole word.
+*/
+void realignFrame(uint32_t* words, uint8_t count) {
+  uint32_t cur = __builtin_bswap32(words[0]);
+  for (uint8_t i = 0; i < count - 1; i++) {
+    uint32_t next = __builtin_bswap32(words[i+1]);
+    words[i] = __builtin_bswap32((cur << 1) | (next >> 31));
+    cur = next;
+  }
+  words[count-1] = __builtin_bswap32(cur << 1);
+}
 
-  // Send/Receive packet
-  SPI.beginTransaction(settingsA);
-  digitalWrite(CS, LOW);
-  //delayMicroseconds(20);
-  for(int i=0; i<length; i++) {
-    in->raw[i] = SPI.transfer(out->raw[i]);
+#ifdef HAS_DEBUG
+// Compare the word kernel with the former byte loop, in CPU cycles
+void realignBenchmark() {
+  union { uint8_t raw[36]; uint32_t words[9]; } a, b;
+  uint32_t t, byte_cycles = 0, word_cycles = 0;
+
+  cyclesBegin();
+  for (int n=0; n<100; n++) {
+    for (uint8_t i=0; i<33; i++) a.raw[i] = random(256);
+    a.raw[33] = a.raw[34] = a.raw[35] = 0;
+    memcpy(b.raw, a.raw, sizeof(b.raw));
+
+    t = cyclesNow();
+    for (int i = 0;  i < 32;  ++i) {
+       a.raw[i] = (a.raw[i] << 1) | ((a.raw[i+1] >> 7) & 1);
+    }
+    a.raw[32] = (a.raw[32] << 1);
+    byte_cycles += cyclesSince(t);
+
+    t = cyclesNow();
+    realignFrame(b.words, 9);
+    word_cycles += cyclesSince(t);
+
+    if (memcmp(a.raw, b.raw, 33) != 0) {
+      Serial.println("realign: word kernel mismatch");
+      return;
+    }
   }
-  digitalWrite(CS, HIGH);
-  SPI.endTransaction();
+  Serial.println(String("realign cycles, byte loop: ") + byte_cycles / 100
+    + ", word kernel: " + word_cycles / 100);
+}
+#endif
+
+// CSW I/O
+// Returns false if the frame was dropped, *in then keeps the last good one
+bool transferCswData(csw_out_t* out, csw_in_t* in, uint8_t length) {
+  // word aligned and zero padded for realignFrame()
+  static union {
+    csw_in_t frame;
+    uint32_t words[9];
+  } buf;
+  csw_in_t& frame = buf.frame;
+  #ifdef RIM_SPI_FIFO
+  bool& bit_slip = csw_bit_slip;
+  #else
+  const bool bit_slip = false;
+  #endif
+  // CRC bits to compare
+  uint8_t crc_mask = 0xFF;
+
+  // Send/Receive packet, CRC is computed on the fly
+  uint8_t crc = rimTransfer(out->raw, frame.raw, length, bit_slip);
 
   /*
     The CSW frame start with a 1 bit value.
@@ -216,40 +761,71 @@ void transferCswData(csw_out_t* out, csw_in_t* in, uint8_t length) {
     This bit is discarded here, and everything is shifted
     to realligned the data correctly with the csw_in_t struct.
   */
-  /*
-  for (int i = 0;  i < length - 1;  ++i) {
-     in->raw[i] = (in->raw[i] << 1) | ((in->raw[i+1] >> 7) & 1);
-  }
-  */
-  if (in->header == 0xd2 || in->header == 0x52){
+  if (frame.header == 0xd2 || frame.header == 0x52){
     // data still not alligned (?!)
     #ifdef HAS_DEBUG
     Serial.print("csw: data not alligned :");
-    Serial.println(in->header, HEX);
+    Serial.println(frame.header, HEX);
     #endif
-    for (int i = 0;  i < length - 1;  ++i) {
-       in->raw[i] = (in->raw[i] << 1) | ((in->raw[i+1] >> 7) & 1);
-    }
-    in->raw[length - 1] = (in->raw[length - 1] << 1);
+    realignFrame(buf.words, (length + 3) / 4);
+    crc = crc8(frame.raw, length-1);
+    // the CRC low bit does not survive the realignment
+    crc_mask = 0xFE;
+    rim_stats.realigned++;
+    #ifdef RIM_SPI_FIFO
+    // let the SPI frame size absorb the extra bit from now on
+    bit_slip = true;
+    #endif
+  }
+  #ifdef RIM_SPI_FIFO
+  else if (bit_slip && (frame.header & 0xFE) != 0xa4) {
+    // the rim is back in step
+    bit_slip = false;
   }
+  #endif
 
-  #ifdef HAS_DEBUG
-  uint8_t crc = crc8(in->raw, length-1);
-  if((crc&0xFE) != in->crc){
+  if ((crc ^ frame.crc) & crc_mask) {
+    rimBadFrame();
+    #ifdef HAS_DEBUG
     Serial.print("Bad CRC: ");
-    Serial.print(in->crc, HEX);
+    Serial.print(frame.crc, HEX);
     Serial.print(" != ");
     Serial.println(crc, HEX);
+    #endif
+    return false;
   }
-  #endif
-
-  if ((in->header & 0xFE) != 0xa4) rim_inserted = NO_WHEEL;
-  //if ((in->header == 0x00) || (in->header == 0xFF)) rim_inserted = NO_WHEEL;
+  rim_bad_run = 0;
+  if ((frame.header & 0xFE) != 0xa4) {
+    rim_inserted = NO_WHEEL;
+    return false;
+  }
+  rim_stats.good++;
+  memcpy(in->raw, frame.raw, length);
+  return true;
 }
 
 // CSL I/O
+// One CSL transaction
+static void cslExchange(csl_out_t* out, csl_in_t* in, uint8_t length) {
+  #ifdef RIM_SPI_FIFO
+  fifoTransfer(out->raw, in->raw, length, 1, false, false);
+  #else
+  SPI.beginTransaction(settingsA);
+  digitalWrite(CS, LOW);
+  delayMicroseconds(CS_WAIT);
+  for(int i=0; i<length; i++) {
+    in->raw[i] = SPI.transfer(out->raw[i]);
+  }
+  digitalWrite(CS, HIGH);
+  SPI.endTransaction();
+  #endif
+}
+
 void transferCslData(csl_out_t* out, csl_in_t* in, uint8_t length, uint8_t selector) {
   out->selector = selector;
+  #ifdef RIM_SPI_DMA
+  rimFrameFlush();
+  #endif
 
   /*
     The CSL output is based on which selector we send.
@@ -257,45 +833,151 @@ void transferCslData(csl_out_t* out, csl_in_t* in, uint8_t length, uint8_t selec
     only the second packet is relevant.
   */
   for (int z=0; z<2; z++) {
-    SPI.beginTransaction(settingsA);
-    digitalWrite(CS, LOW);
-    delayMicroseconds(CS_WAIT);
-    for(int i=0; i<length; i++) {
-      in->raw[i] = SPI.transfer(out->raw[i]);
-    }
-    digitalWrite(CS, HIGH);
-    SPI.endTransaction();
+    cslExchange(out, in, length);
   }
+  csl_pending = selector;
   if (out->selector == 0x00 && in->raw[0] != 0xE0) rim_inserted = NO_WHEEL;
 }
 
-void transferMclData(mcl_out_t* out, mcl_in_t* in, uint8_t length) {
-  // get CRC
-  out->crc = crc8(out->raw, length-1);
+/*
+  Pipelined CSL I/O: send selector, and get in *in the reply to the
+  selector sent by the previous call instead of sending every selector
+  twice. Returns the selector *in belongs to (CSL_NONE for the first one).
+*/
+uint8_t transferCslNext(csl_out_t* out, csl_in_t* in, uint8_t length, uint8_t selector) {
+  uint8_t replied = csl_pending;
+  out->selector = selector;
+  #ifdef RIM_SPI_DMA
+  rimFrameFlush();
+  #endif
 
-  // Send/Receive packet
-  SPI.beginTransaction(settingsA);
-  digitalWrite(CS, LOW);
-  for(int i=0; i<length; i++) {
-    in->raw[i] = SPI.transfer(out->raw[i]);
-  }
-  digitalWrite(CS, HIGH);
-  SPI.endTransaction();
+  cslExchange(out, in, length);
+  csl_pending = selector;
+  if (replied == 0x00 && in->raw[0] != 0xE0) rim_inserted = NO_WHEEL;
+  return replied;
+}
 
-  #ifdef HAS_DEBUG
-  uint8_t crc = crc8(in->raw, length-1);
-  if(crc != in->crc){
+// Returns false if the frame was dropped, *in then keeps the last good one
+bool transferMclData(mcl_out_t* out, mcl_in_t* in, uint8_t length) {
+  static mcl_in_t frame;
+
+  // Send/Receive packet, CRC is computed on the fly
+  uint8_t crc = rimTransfer(out->raw, frame.raw, length);
+
+  if (crc != frame.crc) {
+    rimBadFrame();
+    #ifdef HAS_DEBUG
     Serial.print("Bad CRC: ");
-    Serial.print(in->crc, HEX);
+    Serial.print(frame.crc, HEX);
     Serial.print(" != ");
     Serial.println(crc, HEX);
+    #endif
+    return false;
+  }
+  rim_bad_run = 0;
+  if (frame.header != 0xA5) {
+    rim_inserted = NO_WHEEL;
+    return false;
   }
+  rim_stats.good++;
+  memcpy(in->raw, frame.raw, length);
+  return true;
+}
+
+#ifdef RIM_SAMPLE_RATE
+/*
+  Fixed rate CSW/MCL sampling from a timer interrupt.
+  The ISR is the only writer of the input snapshot; readers use the
+  sequence counter (odd while writing) and retry if it moved under them.
+  The output frame is updated by loop() with interrupts masked.
+  The encoder is a delta, so the ISR also keeps a running sum of it and
+  readers get the sum since their last read: no detent is lost when
+  several samples go by between two reads.
+*/
+IntervalTimer rim_sampler;
+volatile wheel_type sampler_type = NO_WHEEL;
+volatile uint32_t sampler_seq = 0;
+uint32_t sampler_last_seq = 0;
+volatile int32_t sampler_encoder = 0;
+int32_t sampler_last_encoder = 0;
+uint8_t sampler_out[33];
+uint8_t sampler_in[33];
+uint8_t sampler_snap[33];
+
+static void samplerIsr() {
+  // rim removed: loop() will stop us on the next detection
+  if (rim_inserted != sampler_type) return;
+  #ifdef RIM_SPI_DMA
+  // previous frame still clocking: sample on the next tick
+  if (!rimFrameReady()) return;
   #endif
-  if (in->header != 0xA5) rim_inserted = NO_WHEEL;
-  //if ((in->header == 0x00) || (in->header == 0xFF)) rim_inserted = NO_WHEEL;
 
+  bool good;
+  if (sampler_type == CSW_WHEEL)
+    good = transferCswData((csw_out_t*)sampler_out, (csw_in_t*)sampler_in, sizeof(sampler_in));
+  else
+    good = transferMclData((mcl_out_t*)sampler_out, (mcl_in_t*)sampler_in, sizeof(sampler_in));
+  // dropped frame: the snapshot keeps the last good one
+  if (!good) return;
+
+  sampler_seq++;
+  __asm__ volatile ("" ::: "memory");
+  memcpy(sampler_snap, sampler_in, sizeof(sampler_snap));
+  sampler_encoder += ((csw_in_t*)sampler_in)->encoder;
+  __asm__ volatile ("" ::: "memory");
+  sampler_seq++;
+}
+
+// Start sampling a CSW/MCL rim, does nothing if already running
+void samplerStart(wheel_type type) {
+  if (sampler_type == type) return;
+  samplerStop();
+  memset(sampler_out, 0, sizeof(sampler_out));
+  memset(sampler_snap, 0, sizeof(sampler_snap));
+  sampler_out[0] = 0xa5;
+  sampler_last_encoder = sampler_encoder;
+  sampler_type = type;
+  // below the DMA completion interrupt, which may have to preempt us
+  rim_sampler.priority(192);
+  rim_sampler.begin(samplerIsr, 1000000 / RIM_SAMPLE_RATE);
 }
 
+void samplerStop() {
+  if (sampler_type == NO_WHEEL) return;
+  rim_sampler.end();
+  sampler_type = NO_WHEEL;
+}
+
+// Output frame (leds, display, rumble) used by the following samples
+void samplerWrite(const uint8_t* out, uint8_t length) {
+  __disable_irq();
+  memcpy(sampler_out, out, length);
+  __enable_irq();
+}
+
+// Copy the latest input snapshot, return true if it is a new one
+bool samplerRead(uint8_t* in, uint8_t length) {
+  uint32_t seq;
+  int32_t encoder;
+  do {
+    seq = sampler_seq;
+    __asm__ volatile ("" ::: "memory");
+    memcpy(in, sampler_snap, length);
+    encoder = sampler_encoder;
+    __asm__ volatile ("" ::: "memory");
+  } while ((seq & 1) || seq != sampler_seq);
+
+  // encoder: detents since the last read (the rest waits for the next)
+  int8_t delta = constrain(encoder - sampler_last_encoder, -127, 127);
+  ((csw_in_t*)in)->encoder = delta;
+  sampler_last_encoder += delta;
+
+  bool fresh = seq != sampler_last_seq;
+  sampler_last_seq = seq;
+  return fresh;
+}
+#endif
+
 // Convert the CSW 7seg bits to CSL
 uint8_t csw7segToCsl(uint8_t csw_disp) {
   uint8_t csl_disp = 0x00;
@@ -364,4 +1046,22 @@ void fsetup() {
   digitalWrite(CS, HIGH);
   SPI.begin();
   SPI.setClockDivider(0);
+
+  #ifdef CRC8_HW
+  crc8HwSetup();
+  #endif
+
+  #ifdef RIM_SPI_FIFO
+  fifoSetup();
+  fifoRelease();
+  #endif
+
+  #ifdef RIM_SPI_DMA
+  dma_tx.triggerAtHardwareEvent(DMAMUX_SOURCE_SPI0_TX);
+  dma_tx.disableOnCompletion();
+  dma_rx.triggerAtHardwareEvent(DMAMUX_SOURCE_SPI0_RX);
+  dma_rx.disableOnCompletion();
+  dma_rx.interruptAtCompletion();
+  dma_rx.attachInterrupt(dmaFrameDone);
+  #endif
 }
\ No newline at end of file
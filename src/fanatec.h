@@ -23,6 +23,11 @@
 #include <SPI.h>
 #define CS 10
 
+// Teensy 3.x: crc8() runs on the CRC module, the LC uses the table
+#if defined(KINETISK)
+#define CRC8_HW
+#endif
+
 #define NO_RIM 0
 #define BMW_RIM 1
 #define FORMULA_RIM 2
@@ -34,6 +39,9 @@
 #define CSLP1PS4 8
 #define CSLMCLGT3 9
 
+// No CSL selector (empty pipeline)
+#define CSL_NONE 0xFF
+
 enum wheel_type {
   NO_WHEEL,
   CSW_WHEEL,
@@ -137,11 +145,61 @@ struct mcl_out_t {
 #pragma pack(pop)
 
 wheel_type detectWheelType();
+wheel_type currentWheelType();
+extern uint32_t rim_resync_us;
+extern uint32_t rim_session;
 uint8_t getFirstByte();
 uint8_t crc8(const uint8_t* buf, uint8_t length);
-void transferCswData(csw_out_t* out, csw_in_t* in, uint8_t length);
+#ifdef CRC8_HW
+void crc8HwSetup();
+#ifdef HAS_DEBUG
+bool crc8SelfTest();
+#endif
+#endif
+extern const char* rim_spi_backend;
+extern volatile uint32_t rim_frame_us;
+
+struct rim_stats_t {
+  uint32_t good;
+  uint32_t bad;
+  uint32_t realigned;
+};
+extern volatile rim_stats_t rim_stats;
+
+// SPI timing candidates, see rimSetTiming()
+#define RIM_CLOCKS 6
+#define RIM_CLOCK_DEFAULT 2 // 12MHz
+extern const uint32_t rim_clocks[RIM_CLOCKS];
+extern volatile wheel_type rim_inserted;
+extern unsigned int CS_WAIT;
+extern unsigned int rim_cs_setup;
+void rimSetTiming(wheel_type type, uint8_t clock, uint8_t mode, uint8_t cs_wait);
+void rimDefaultTiming();
+
+uint8_t rimTransfer(uint8_t* out, uint8_t* in, uint8_t length, bool bit_slip = false);
+#ifdef RIM_SPI_DMA
+void rimFrameStart(const uint8_t* out, uint8_t length);
+bool rimFrameReady();
+void rimFrameFlush();
+#endif
+#ifdef RIM_SPI_FIFO
+void fifoSetup();
+void fifoRelease();
+#endif
+void realignFrame(uint32_t* words, uint8_t count);
+#ifdef HAS_DEBUG
+void realignBenchmark();
+#endif
+bool transferCswData(csw_out_t* out, csw_in_t* in, uint8_t length);
 void transferCslData(csl_out_t* out, csl_in_t* in, uint8_t length, uint8_t selector);
-void transferMclData(mcl_out_t* out, mcl_in_t* in, uint8_t length);
+uint8_t transferCslNext(csl_out_t* out, csl_in_t* in, uint8_t length, uint8_t selector);
+bool transferMclData(mcl_out_t* out, mcl_in_t* in, uint8_t length);
+#ifdef RIM_SAMPLE_RATE
+void samplerStart(wheel_type type);
+void samplerStop();
+void samplerWrite(const uint8_t* out, uint8_t length);
+bool samplerRead(uint8_t* in, uint8_t length);
+#endif
 uint8_t csw7segToCsl(uint8_t csw_disp);
 uint8_t csw7segToAscii(uint8_t csw_disp);
 
@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2015 darknao
+ * https://github.com/darknao/btClubSportWheel
+ *
+ * This file is part of btClubSportWheel.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "WProgram.h"
+#include "usbsync.h"
+
+#if defined(USB_SYNC_LEAD) && defined(IS_USB)
+#include "usb_dev.h"
+
+volatile uint32_t usb_sync_phase = 0;
+volatile int32_t usb_sync_slack = 0;
+volatile uint8_t usb_sync_period = 0;
+
+volatile uint32_t sync_sof_us;       // last start of frame
+volatile uint16_t sync_poll_frame;   // frame of the last poll seen
+volatile uint16_t sync_next_frame;   // frame of the next poll
+volatile uint32_t sync_next_us;      // its expected time
+uint16_t sync_done_frame = 0xFFFF;   // poll already sampled for
+uint32_t sync_queued_us;
+uint8_t sync_gaps = 0;               // gaps checked in this window
+uint8_t sync_misses = 0;             // and not a multiple of the period
+
+#define FRAME_MASK 0x7FF
+
+static void syncSof() {
+  uint32_t now = micros();
+  uint16_t frame = usb_frame_number();
+  uint8_t period = usb_sync_period;
+
+  sync_sof_us = now;
+  if (!period) return;
+
+  uint16_t since = (frame - sync_poll_frame) & FRAME_MASK;
+  if (since > period * USB_SYNC_TIMEOUT) {
+    // no report taken for a while, don't trust the phase anymore
+    usb_sync_period = 0;
+    return;
+  }
+  uint16_t ahead = (period - since % period) % period;
+  sync_next_frame = (frame + ahead) & FRAME_MASK;
+  sync_next_us = now + ahead * 1000 + usb_sync_phase;
+}
+
+static void syncTx(uint32_t endpoint) {
+  if (endpoint != JOYSTICK_ENDPOINT) return;
+  uint32_t now = micros();
+  uint16_t frame = usb_frame_number();
+  uint16_t gap = (frame - sync_poll_frame) & FRAME_MASK;
+
+  // gaps are multiples of the polling period (polls without a report
+  // are not seen), the smallest one is the period. A gap that is not a
+  // multiple means the period is wrong (e.g. too small from a poll seen
+  // late): learn it again, so it can grow as well.
+  if (gap && gap <= 32) {
+    uint8_t period = usb_sync_period;
+    if (!period || gap < period) {
+      usb_sync_period = gap;
+      sync_gaps = sync_misses = 0;
+    } else {
+      if (gap % period) sync_misses++;
+      if (sync_misses >= USB_SYNC_MISSES) {
+        usb_sync_period = 0;
+        sync_gaps = sync_misses = 0;
+      } else if (++sync_gaps >= USB_SYNC_WINDOW) {
+        sync_gaps = sync_misses = 0;
+      }
+    }
+  }
+  sync_poll_frame = frame;
+  usb_sync_phase = now - sync_sof_us;
+  usb_sync_slack = now - sync_queued_us;
+}
+
+void usbSyncBegin() {
+  usb_sof_hook = syncSof;
+  usb_tx_hook = syncTx;
+}
+
+// Time to sample the rim for the next poll (once per poll)
+bool usbSyncDue() {
+  if (!usb_sync_period) return true;
+
+  __disable_irq();
+  uint16_t frame = sync_next_frame;
+  uint32_t poll = sync_next_us;
+  __enable_irq();
+
+  if (frame == sync_done_frame) return false;
+  if ((int32_t)(micros() - (poll - USB_SYNC_LEAD)) < 0) return false;
+  sync_done_frame = frame;
+  return true;
+}
+
+// The report was just queued
+void usbSyncQueued() {
+  sync_queued_us = micros();
+}
+
+// A report is wanted even if nothing changed: polls are only seen when
+// they take one, so to learn the period (reports on consecutive polls)
+// and before the lock times out
+bool usbSyncWanted() {
+  uint8_t period = usb_sync_period;
+  if (!period) return true;
+  uint16_t since = (usb_frame_number() - sync_poll_frame) & FRAME_MASK;
+  return since >= period * USB_SYNC_TIMEOUT / 2;
+}
+
+#endif
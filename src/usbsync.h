@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2015 darknao
+ * https://github.com/darknao/btClubSportWheel
+ *
+ * This file is part of btClubSportWheel.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _USBSYNC_H_
+#define _USBSYNC_H_
+
+#include <inttypes.h>
+
+/*
+  Start of frame synchronisation (USB_SYNC_LEAD, in µs).
+  The joystick polls seen by the USB interrupt give the host polling
+  period (in frames) and phase (µs after the start of frame). loop()
+  then samples the rim and queues the report USB_SYNC_LEAD µs before
+  the next poll, so the report the host gets is as fresh as it can be.
+  Until polls have been seen (or when the host stops polling), loop()
+  runs freely.
+*/
+#ifdef USB_SYNC_LEAD
+
+// Polls missed before falling back to free running
+#define USB_SYNC_TIMEOUT 64
+// Gaps between polls that are not a multiple of the period (out of
+// USB_SYNC_WINDOW) before the period is learned again
+#define USB_SYNC_MISSES 4
+#define USB_SYNC_WINDOW 16
+
+extern volatile uint32_t usb_sync_phase; // µs from start of frame to poll
+extern volatile int32_t usb_sync_slack;  // µs from report queued to poll
+extern volatile uint8_t usb_sync_period; // frames between polls, 0: unknown
+
+void usbSyncBegin();
+bool usbSyncDue();
+void usbSyncQueued();
+bool usbSyncWanted();
+
+#endif
+
+#endif
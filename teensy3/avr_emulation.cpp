@@ -39,6 +39,7 @@ uint8_t SPCR1emulation::pinout = 0;
 
 #ifdef HAS_SPIFIFO
 
+SPIFIFOclass SPIFIFO;
 uint8_t SPIFIFOclass::pcs = 0;
 volatile uint8_t * SPIFIFOclass::reg = 0;
 
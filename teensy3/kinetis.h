@@ -2373,6 +2373,11 @@ typedef struct {
 #define CRC_CRC			(*(volatile uint32_t *)0x40032000) // CRC Data register
 #define CRC_GPOLY		(*(volatile uint32_t *)0x40032004) // CRC Polynomial register
 #define CRC_CTRL		(*(volatile uint32_t *)0x40032008) // CRC Control register
+#define CRC_CTRL_TOT(n)		(((n) & 3) << 30)		// Type Of Transpose for Writes
+#define CRC_CTRL_TOTR(n)	(((n) & 3) << 28)		// Type Of Transpose for Read
+#define CRC_CTRL_FXOR		((uint32_t)0x04000000)		// Complement Read Of CRC data register
+#define CRC_CTRL_WAS		((uint32_t)0x02000000)		// Write CRC data register As Seed
+#define CRC_CTRL_TCRC		((uint32_t)0x01000000)		// Width of CRC protocol (0=16 bits, 1=32 bits)
 
 // Cryptographic Acceleration Unit (CAU)
 
@@ -115,14 +115,14 @@ static uint8_t joystick_report_desc[] = {
     0x09, 0x04,                    // USAGE (Joystick)
     0xa1, 0x01,                    // COLLECTION (Application)
 
-        // 88 Buttons (88bits)
+        // 88 Buttons (88bits), or COMPACT_BUTTONS
         0x05, 0x09,                    //   USAGE_PAGE (Button)
             0x19, 0x01,                    //   USAGE_MINIMUM (Button 1)
-            0x29, 0x58,                    //   USAGE_MAXIMUM (Button 88)
+            0x29, JOYSTICK_BUTTONS,        //   USAGE_MAXIMUM (Button 88)
             0x15, 0x00,                    //   LOGICAL_MINIMUM (0)
             0x25, 0x01,                    //   LOGICAL_MAXIMUM (1)
             0x75, 0x01,                    //   REPORT_SIZE (1)
-            0x95, 0x58,                    //   REPORT_COUNT (88)
+            0x95, JOYSTICK_BUTTONS,        //   REPORT_COUNT (88)
             0x81, 0x02,                    //   INPUT (Data,Var,Abs)
               //   no padding ( 88 )
 
@@ -151,12 +151,36 @@ static uint8_t joystick_report_desc[] = {
             0x75, 0x04,                    //   REPORT_SIZE (4)
             0x95, 0x01,                    //   REPORT_COUNT (1)
             0x81, 0x42,                    //   INPUT (Data,Var,Abs)
-              //   padding ( total 124 -> (-256) 132 (4x33) )
-            0x95, 0x21,                    //   REPORT_COUNT (33)
+#ifdef COMPACT_BUTTONS
+              //   padding ( 4 + wheel id 8 )
+            0x95, 0x03,                    //   REPORT_COUNT (3)
+#else
+              //   padding ( total 116 -> (-248) 116 (4x29) )
+            0x95, 0x1D,                    //   REPORT_COUNT (29)
+#endif
             0x75, 0x04,                    //   REPORT_SIZE (4)
             0x81, 0x01,                    //   INPUT (Cnst,Ary,Abs)
 
+        // GT3 switch positions, raw (8bits)
+        0x06, 0x00, 0xFF,              //   USAGE_PAGE (Vendor Defined)
+            0x09, 0x01,                    //   USAGE (Vendor Usage 1)
+            0x15, 0x00,                    //   LOGICAL_MINIMUM (0)
+            0x26, 0xff, 0x00,              //   LOGICAL_MAXIMUM (255)
+            0x75, 0x08,                    //   REPORT_SIZE (8)
+            0x95, 0x01,                    //   REPORT_COUNT (1)
+            0x81, 0x02,                    //   INPUT (Data,Var,Abs)
+
+        // Rotary encoder, detents since the last report (8bits)
+        0x05, 0x01,                    //   USAGE_PAGE (Generic Desktop)
+            0x09, 0x37,                    //   USAGE (Dial)
+            0x15, 0x81,                    //   LOGICAL_MINIMUM (-127)
+            0x25, 0x7F,                    //   LOGICAL_MAXIMUM (127)
+            0x75, 0x08,                    //   REPORT_SIZE (8)
+            0x95, 0x01,                    //   REPORT_COUNT (1)
+            0x81, 0x06,                    //   INPUT (Data,Var,Rel)
+
         // Total size : 256bits -> 32bytes (JOYSTICK_SIZE)
+        // Compact: COMPACT_BUTTONS + 64bits
 
     // 4 LEDs
 
@@ -96,11 +96,20 @@ let me know?  http://forum.pjrc.com/forums/4-Suggestions-amp-Bug-Reports
 #ifdef IS_USB
   #define JOYSTICK_INTERFACE    0
   #define JOYSTICK_ENDPOINT     1
+#ifdef COMPACT_BUTTONS
+  #if COMPACT_BUTTONS % 8 || COMPACT_BUTTONS < 8 || COMPACT_BUTTONS > 88
+  #error "COMPACT_BUTTONS must be a multiple of 8, up to 88"
+  #endif
+  #define JOYSTICK_BUTTONS      COMPACT_BUTTONS
+  #define JOYSTICK_SIZE         (COMPACT_BUTTONS / 8 + 8)
+#else
+  #define JOYSTICK_BUTTONS      88
   #define JOYSTICK_SIZE         32
+#endif
   #define JOYSTICK_INTERVAL     5
   #define LIGHTS_ENDPOINT       1
   #define LIGHTS_SIZE           8
-  #define LIGHTS_INTERVAL       16
+  #define LIGHTS_INTERVAL       1
   #define JOYSTICK_NAME         {'C', 'l', 'u', 'b', 'S', 'p', 'o', 'r', 't', ' ', 'W', 'h', 'e' ,'e', 'l'}
   #define JOYSTICK_NAME_LEN     15
 
@@ -61,6 +61,11 @@ static usb_packet_t *tx_last[NUM_ENDPOINTS];
 uint16_t usb_rx_byte_count_data[NUM_ENDPOINTS];
 
 static uint8_t tx_state[NUM_ENDPOINTS];
+
+// Optional hooks, called from usb_isr(): at every start of frame, and
+// when a packet was sent on an endpoint (1 based)
+void (*usb_sof_hook)(void) = NULL;
+void (*usb_tx_hook)(uint32_t endpoint) = NULL;
 #define TX_STATE_BOTH_FREE_EVEN_FIRST	0
 #define TX_STATE_BOTH_FREE_ODD_FIRST	1
 #define TX_STATE_EVEN_FREE		2
@@ -361,10 +366,29 @@ static void usb_setup(void)
 	  case 0x0921: // HID SET_REPORT
 		//serial_print(":)\n");
 		return;
+#ifndef JOYSTICK_INTERFACE
 	  case 0x0A21: // HID SET_IDLE
 		break;
+#endif
 	  // case 0xC940:
 #endif
+
+#ifdef JOYSTICK_INTERFACE
+	  case 0x0A21: // HID SET_IDLE
+		if ((setup.wIndex & 0xFF) == JOYSTICK_INTERFACE) {
+			usb_joystick_idle_config = setup.wValue >> 8;
+		}
+		break;
+	  case 0x02A1: // HID GET_IDLE
+		if ((setup.wIndex & 0xFF) != JOYSTICK_INTERFACE) {
+			endpoint0_stall();
+			return;
+		}
+		reply_buffer[0] = usb_joystick_idle_config;
+		data = reply_buffer;
+		datalen = 1;
+		break;
+#endif
 	  default:
 		endpoint0_stall();
 		return;
@@ -613,6 +637,21 @@ uint32_t usb_tx_packet_count(uint32_t endpoint)
 	return count;
 }
 
+// Frame number of the last start of frame (11 bits)
+uint32_t usb_frame_number(void)
+{
+	return USB0_FRMNUML | ((USB0_FRMNUMH & 0x07) << 8);
+}
+
+// Nothing queued nor loaded in the buffer descriptors: a packet sent
+// now is the next one the host gets
+int usb_tx_idle(uint32_t endpoint)
+{
+	endpoint--;
+	if (endpoint >= NUM_ENDPOINTS) return 0;
+	return tx_first[endpoint] == NULL && tx_state[endpoint] <= TX_STATE_BOTH_FREE_ODD_FIRST;
+}
+
 
 // Called from usb_free, but only when usb_rx_memory_needed > 0, indicating
 // receive endpoints are starving for memory.  The intention is to give
@@ -665,13 +704,20 @@ void usb_rx_memory(usb_packet_t *packet)
 //#define stat2bufferdescriptor(stat) (table + ((stat) >> 2))
 
 void usb_tx(uint32_t endpoint, usb_packet_t *packet)
+{
+	__disable_irq();
+	usb_tx_isr(endpoint, packet);
+	__enable_irq();
+}
+
+// usb_tx() with interrupts already masked (from the USB interrupt)
+void usb_tx_isr(uint32_t endpoint, usb_packet_t *packet)
 {
 	bdt_t *b = &table[index(endpoint, TX, EVEN)];
 	uint8_t next;
 
 	endpoint--;
 	if (endpoint >= NUM_ENDPOINTS) return;
-	__disable_irq();
 	//serial_print("txstate=");
 	//serial_phex(tx_state[endpoint]);
 	//serial_print("\n");
@@ -697,13 +743,11 @@ void usb_tx(uint32_t endpoint, usb_packet_t *packet)
 			tx_last[endpoint]->next = packet;
 		}
 		tx_last[endpoint] = packet;
-		__enable_irq();
 		return;
 	}
 	tx_state[endpoint] = next;
 	b->addr = packet->buf;
 	b->desc = BDT_DESC(packet->len, ((uint32_t)b & 8) ? DATA1 : DATA0);
-	__enable_irq();
 }
 
 
@@ -757,6 +801,10 @@ void usb_isr(void)
 #ifdef FLIGHTSIM_INTERFACE
 			usb_flightsim_flush_callback();
 #endif
+#ifdef JOYSTICK_INTERFACE
+			usb_joystick_sof_callback();
+#endif
+			if (usb_sof_hook) usb_sof_hook();
 		}
 		USB0_ISTAT = USB_ISTAT_SOFTOK;
 	}
@@ -788,6 +836,7 @@ void usb_isr(void)
 
 			if (stat & 0x08) { // transmit
 				usb_free(packet);
+				if (usb_tx_hook) usb_tx_hook(endpoint + 1);
 				packet = tx_first[endpoint];
 				if (packet) {
 					//serial_print("tx packet\n");
@@ -828,6 +877,9 @@ void usb_isr(void)
 						break;
 					}
 				}
+#ifdef JOYSTICK_INTERFACE
+				if (endpoint + 1 == JOYSTICK_ENDPOINT) usb_joystick_flush_callback();
+#endif
 			} else { // receive
 				packet->len = b->desc >> 16;
 				if (packet->len > 0) {
@@ -53,11 +53,16 @@ void usb_isr(void);
 usb_packet_t *usb_rx(uint32_t endpoint);
 uint32_t usb_tx_byte_count(uint32_t endpoint);
 uint32_t usb_tx_packet_count(uint32_t endpoint);
+int usb_tx_idle(uint32_t endpoint);
+uint32_t usb_frame_number(void);
 void usb_tx(uint32_t endpoint, usb_packet_t *packet);
 void usb_tx_isr(uint32_t endpoint, usb_packet_t *packet);
 
 extern volatile uint8_t usb_configuration;
 
+extern void (*usb_sof_hook)(void);
+extern void (*usb_tx_hook)(uint32_t endpoint);
+
 extern uint16_t usb_rx_byte_count_data[NUM_ENDPOINTS];
 static inline uint32_t usb_rx_byte_count(uint32_t endpoint) __attribute__((always_inline));
 static inline uint32_t usb_rx_byte_count(uint32_t endpoint)
@@ -96,6 +101,12 @@ extern void usb_midi_flush_output(void);
 extern void usb_flightsim_flush_callback(void);
 #endif
 
+#ifdef JOYSTICK_INTERFACE
+extern volatile uint8_t usb_joystick_idle_config;
+extern void usb_joystick_flush_callback(void);
+extern void usb_joystick_sof_callback(void);
+#endif
+
 
 
 
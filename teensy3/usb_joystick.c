@@ -36,12 +36,45 @@
 #ifdef JOYSTICK_INTERFACE // defined by usb_dev.h -> usb_desc.h
 
 
-uint8_t usb_joystick_data[32];
+/*
+  Double buffered report: usb_joystick_data is the back buffer, only
+  written by the sketch. usb_joystick_submit() and usb_joystick_send()
+  make it the front buffer (a pointer flip, with the sequence counter
+  bumped) and the sketch goes on in the other one, so the transport only
+  ever reads whole reports, from the front buffer.
+  The per field setters only write what changed, so the new back buffer
+  starts as a copy of the report just published: JOYSTICK_SIZE bytes,
+  about what rebuilding it from the sketch state would cost.
+*/
+static uint8_t joystick_reports[2][JOYSTICK_SIZE];
+uint8_t *usb_joystick_data = joystick_reports[0];
+const uint8_t * volatile usb_joystick_front = joystick_reports[1];
+volatile uint32_t usb_joystick_seq = 0;
 
 
 // Maximum number of transmit packets to queue so we don't starve other endpoints for memory
 #define TX_PACKET_LIMIT 3
 
+// Latest report submitted and not sent yet
+static volatile uint8_t pending = 0;
+
+// Make the back buffer the front one (pending: to be sent by the USB
+// interrupt) and go on in the other one
+static void joystick_flip(uint8_t pend)
+{
+	uint8_t *back;
+
+	__disable_irq();
+	back = (uint8_t *)usb_joystick_front;
+	usb_joystick_front = usb_joystick_data;
+	usb_joystick_seq++;
+	pending = pend;
+	__enable_irq();
+	// the sketch only writes what changed: go on from this report
+	memcpy(back, usb_joystick_data, JOYSTICK_SIZE);
+	usb_joystick_data = back;
+}
+
 static uint8_t transmit_previous_timeout=0;
 
 // When the PC isn't listening, how long do we wait before discarding data?
@@ -89,13 +122,95 @@ int usb_joystick_send(void)
                 yield();
         }
 	transmit_previous_timeout = 0;
-	memcpy(tx_packet->buf, usb_joystick_data, JOYSTICK_SIZE);
+	// sent now: this report replaces any pending one
+	joystick_flip(0);
+	memcpy(tx_packet->buf, (const uint8_t *)usb_joystick_front, JOYSTICK_SIZE);
         tx_packet->len = JOYSTICK_SIZE;
         usb_tx(JOYSTICK_ENDPOINT, tx_packet);
 	//serial_print("ok\n");
         return 0;
 }
 
+/*
+  HID idle rate, set by the host (SET_IDLE, in 4 ms units, 0: never).
+  An unchanged report is repeated once the idle period ran out since the
+  last one sent; changes go out at once. usb_joystick_repeats counts the
+  repeated reports (usb_joystick_seq counts the submitted ones).
+*/
+volatile uint8_t usb_joystick_idle_config = 0;
+volatile uint32_t usb_joystick_repeats = 0;
+static volatile uint16_t idle_ms = 0;
+
+// Send the pending report in tx_packet if the endpoint is free, with
+// interrupts masked. Returns 0 if tx_packet was not used.
+static int joystick_tx(usb_packet_t *tx_packet)
+{
+	if (!pending || !usb_tx_idle(JOYSTICK_ENDPOINT)) return 0;
+	memcpy(tx_packet->buf, (const uint8_t *)usb_joystick_front, JOYSTICK_SIZE);
+	tx_packet->len = JOYSTICK_SIZE;
+	pending = 0;
+	idle_ms = 0;
+	usb_tx_isr(JOYSTICK_ENDPOINT, tx_packet);
+	return 1;
+}
+
+// Never waits: the report goes out now if the endpoint is free, else it
+// replaces the one pending, sent by the USB interrupt once it is
+int usb_joystick_submit(void)
+{
+	usb_packet_t *tx_packet;
+	int sent;
+
+	if (!usb_configuration) return -1;
+	joystick_flip(1);
+	// endpoint busy: the interrupt sends it once it is free
+	if (!usb_tx_idle(JOYSTICK_ENDPOINT)) return 0;
+	tx_packet = usb_malloc();
+	if (!tx_packet) return 0; // next start of frame
+	__disable_irq();
+	sent = joystick_tx(tx_packet);
+	__enable_irq();
+	if (!sent) usb_free(tx_packet);
+	return 0;
+}
+
+int usb_joystick_pending(void)
+{
+	return pending;
+}
+
+// From the USB interrupt (start of frame, packet sent): send the pending
+// report if the endpoint is free
+void usb_joystick_flush_callback(void)
+{
+	usb_packet_t *tx_packet;
+
+	if (!pending || !usb_tx_idle(JOYSTICK_ENDPOINT)) return;
+	tx_packet = usb_malloc();
+	if (!tx_packet) return; // next start of frame
+	if (!joystick_tx(tx_packet)) usb_free(tx_packet);
+}
+
+// Start of frame (USB interrupt): repeat the last report when the idle
+// period ran out, then send what is pending
+void usb_joystick_sof_callback(void)
+{
+	uint16_t idle = usb_joystick_idle_config * 4;
+
+	if (idle_ms < 0xFFFF) idle_ms++;
+	if (idle && idle_ms >= idle && !pending) {
+		pending = 1;
+		usb_joystick_repeats++;
+	}
+	usb_joystick_flush_callback();
+}
+
+// Milliseconds since the last report sent
+int usb_joystick_idle(void)
+{
+	return idle_ms;
+}
+
 int usb_lights_recv(void *buffer, uint32_t timeout)
 {
 	usb_packet_t *rx_packet;
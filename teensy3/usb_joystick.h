@@ -36,13 +36,41 @@
 #if defined(JOYSTICK_INTERFACE)
 
 #include <inttypes.h>
+#include <string.h>
 
 // C language implementation
 #ifdef __cplusplus
 extern "C" {
 #endif
 int usb_joystick_send(void);
-extern uint8_t usb_joystick_data[32];
+int usb_joystick_submit(void);
+int usb_joystick_pending(void);
+int usb_joystick_idle(void);
+extern uint8_t *usb_joystick_data;
+extern const uint8_t * volatile usb_joystick_front;
+extern volatile uint32_t usb_joystick_seq;
+extern volatile uint32_t usb_joystick_repeats;
+extern volatile uint8_t usb_joystick_idle_config;
+
+// Joystick report layout (usb_joystick_data), without the padding
+// with COMPACT_BUTTONS
+typedef union {
+	struct {
+		uint8_t buttons[JOYSTICK_BUTTONS / 8];
+		uint8_t x;
+		uint8_t y;
+		uint8_t clutch1;
+		uint8_t clutch2;
+		uint8_t hat;
+#ifndef COMPACT_BUTTONS
+		uint8_t padding[13];
+#endif
+		uint8_t wheel;
+		uint8_t switches;
+		int8_t encoder;
+	};
+	uint8_t raw[JOYSTICK_SIZE];
+} usb_joystick_report_t;
 int usb_lights_recv(void *buffer, uint32_t timeout);
 int usb_lights_available(void);
 
@@ -56,76 +84,79 @@ class usb_joystick_class
 {
     private:
         static uint8_t manual_mode;
+        usb_joystick_report_t *report(void) {
+            return (usb_joystick_report_t *)usb_joystick_data;
+        }
 
     public:
         void begin(void) { }
         void end(void) { }
         void button(uint8_t button, bool val) {
-            if (--button >= 88) return;
-            if (button >= 80) {
-                if (val) usb_joystick_data[10] |= (0x1 << (button-80));
-                else usb_joystick_data[10] &= ~(0x1 << (button-80));
-            } else if (button >= 72) {
-                if (val) usb_joystick_data[9] |= (0x1 << (button-72));
-                else usb_joystick_data[9] &= ~(0x1 << (button-72));
-            } else if (button >= 64) {
-                if (val) usb_joystick_data[8] |= (0x1 << (button-64));
-                else usb_joystick_data[8] &= ~(0x1 << (button-64));
-            } else if (button >= 56) {
-                if (val) usb_joystick_data[7] |= (0x1 << (button-56));
-                else usb_joystick_data[7] &= ~(0x1 << (button-56));
-            } else if (button >= 48) {
-                if (val) usb_joystick_data[6] |= (0x1 << (button-48));
-                else usb_joystick_data[6] &= ~(0x1 << (button-48));
-            } else if (button >= 40) {
-                if (val) usb_joystick_data[5] |= (0x1 << (button-40));
-                else usb_joystick_data[5] &= ~(0x1 << (button-40));
-            } else if (button >= 32) {
-                if (val) usb_joystick_data[4] |= (0x1 << (button-32));
-                else usb_joystick_data[4] &= ~(0x1 << (button-32));
-            } else if (button >= 24) {
-                if (val) usb_joystick_data[3] |= (0x1 << (button-24));
-                else usb_joystick_data[3] &= ~(0x1 << (button-24));
-            } else if (button >= 16) {
-                if (val) usb_joystick_data[2] |= (0x1 << (button-16));
-                else usb_joystick_data[2] &= ~(0x1 << (button-16));
-            } else if (button >= 8) {
-                if (val) usb_joystick_data[1] |= (0x1 << (button-8));
-                else usb_joystick_data[1] &= ~(0x1 << (button-8));
-            } else {
-                if (val) usb_joystick_data[0] |= (0x1 << (button));
-                else usb_joystick_data[0] &= ~(0x1 << (button));
+            if (--button >= JOYSTICK_BUTTONS) return;
+            if (val) usb_joystick_data[button >> 3] |= (0x1 << (button & 7));
+            else usb_joystick_data[button >> 3] &= ~(0x1 << (button & 7));
+            if (!manual_mode) usb_joystick_send();
+        }
+
+        // Buttons offset+1 to offset+32 of state: the ones in mask are set from bits
+        static void setButtons(usb_joystick_report_t &state, uint8_t offset, uint32_t mask, uint32_t bits) {
+            uint8_t i = offset >> 3;
+            uint64_t m = (uint64_t)mask << (offset & 7);
+            uint64_t b = ((uint64_t)bits << (offset & 7)) & m;
+            for (; m && i < JOYSTICK_BUTTONS / 8; i++, m >>= 8, b >>= 8) {
+                state.buttons[i] = (state.buttons[i] & ~m) | b;
             }
+        }
+
+        // Buttons offset+1 to offset+32: the ones in mask are set from bits
+        void setButtons(uint8_t offset, uint32_t mask, uint32_t bits) {
+            setButtons(*report(), offset, mask, bits);
+            if (!manual_mode) usb_joystick_send();
+        }
+
+        // Whole report at once, built by the sketch
+        void setReport(const usb_joystick_report_t &state) {
+            memcpy(usb_joystick_data, state.raw, sizeof(state.raw));
             if (!manual_mode) usb_joystick_send();
         }
 
         void X(unsigned int val) {
-            usb_joystick_data[11] = val & 0xFF;
+            report()->x = val & 0xFF;
             if (!manual_mode) usb_joystick_send();
         }
 
         void Y(unsigned int val) {
-            usb_joystick_data[12] = val & 0xFF;
+            report()->y = val & 0xFF;
             if (!manual_mode) usb_joystick_send();
         }
 
         void clutch1(unsigned int val) {
-            usb_joystick_data[13] = val & 0xFF;
+            report()->clutch1 = val & 0xFF;
             if (!manual_mode) usb_joystick_send();
         }
 
         void clutch2(unsigned int val) {
-            usb_joystick_data[14] = val & 0xFF;
+            report()->clutch2 = val & 0xFF;
             if (!manual_mode) usb_joystick_send();
         }
 
         inline void hat(int val) {
-            usb_joystick_data[15] = val & 0xFF;
+            report()->hat = val & 0xFF;
             if (!manual_mode) usb_joystick_send();
         }
 
         void setWheel(unsigned int val) {
-            usb_joystick_data[29] = val & 0xFF;
+            report()->wheel = val & 0xFF;
+            if (!manual_mode) usb_joystick_send();
+        }
+
+        void setSwitch(unsigned int val) {
+            report()->switches = val & 0xFF;
+            if (!manual_mode) usb_joystick_send();
+        }
+
+        void encoder(int val) {
+            report()->encoder = val & 0xFF;
             if (!manual_mode) usb_joystick_send();
         }
 
@@ -135,6 +166,19 @@ class usb_joystick_class
         void send_now(void) {
             usb_joystick_send();
         }
+        // Never blocks, replaces the report not sent yet (if any)
+        void submit(void) {
+            usb_joystick_submit();
+        }
+        bool pending(void) { return usb_joystick_pending(); }
+        // Last report submitted, and how many were
+        const uint8_t *submitted(void) { return usb_joystick_front; }
+        uint32_t sequence(void) { return usb_joystick_seq; }
+        // Host idle period in ms (0: unchanged reports are never repeated),
+        // ms since the last report sent, and how many were repeats
+        uint16_t idleRate(void) { return usb_joystick_idle_config * 4; }
+        uint16_t idle(void) { return usb_joystick_idle(); }
+        uint32_t repeats(void) { return usb_joystick_repeats; }
 
         int available(void) {return usb_lights_available(); }
         int recv(void *buffer, uint16_t timeout) { return usb_lights_recv(buffer, timeout); }